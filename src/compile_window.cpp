@@ -26,11 +26,24 @@ void CompileWindow::setRule(RulesetView::Ref rule)
 {
   m_rule = rule;
   m_ui.rulePath->setText(rule->file().c_str());
+  /* performance findings from the linter are listed after the compiler's own messages */
+  std::stringstream messages(rule->compilerMessages());
   std::stringstream ss;
-  ss << rule->compilerMessages();
+  std::string performance;
+  std::string line;
+  while (std::getline(messages, line)) {
+    if (line.find("): performance: ") != std::string::npos) {
+      performance += line + "\n";
+    } else {
+      ss << line << std::endl;
+    }
+  }
   if (rule->isCompiled()) {
     ss << "Rule compiled successfully." << std::endl;
   }
+  if (!performance.empty()) {
+    ss << std::endl << "Performance:" << std::endl << performance;
+  }
   m_ui.output->setText(ss.str().c_str());
 }
 
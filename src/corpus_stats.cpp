@@ -0,0 +1,198 @@
+#include "corpus_stats.h"
+#include <algorithm>
+#include <string.h>
+
+namespace {
+
+const size_t EntropyBins = 1024;
+const size_t SizeSteps = 16; /* per power of two */
+const size_t SizeBuckets = SizeSteps + (64 - 4) * SizeSteps;
+const size_t ProfileCapacity = 64;
+
+bool moreFrequent(const CorpusStats::Profile& a, const CorpusStats::Profile& b)
+{
+  return a.count > b.count;
+}
+
+}
+
+CorpusStats::~CorpusStats()
+{
+}
+
+CorpusStats::CorpusStats()
+{
+  reset();
+}
+
+void CorpusStats::reset()
+{
+  m_fileCount = 0;
+  m_errorCount = 0;
+  m_approximateCount = 0;
+  m_totalBytes = 0;
+  m_entropy = std::vector<uint64_t>(EntropyBins);
+  m_sizes = std::vector<uint64_t>(SizeBuckets);
+  m_bytes = std::vector<double>(256);
+  m_profiles.clear();
+}
+
+void CorpusStats::add(FileStats::Ref stats)
+{
+  m_fileCount++;
+  if (stats->accessError()) {
+    m_errorCount++;
+    return;
+  }
+  if (stats->isApproximate()) {
+    m_approximateCount++;
+  }
+  m_totalBytes += stats->fileSize();
+
+  const double entropy = std::min(8.0, std::max(0.0, stats->totalEntropy()));
+  m_entropy[std::min(EntropyBins - 1, size_t(entropy / 8 * EntropyBins))]++;
+  m_sizes[sizeBucket(stats->fileSize())]++;
+
+  const std::vector<double>& histogram = stats->histogram();
+  for (int b = 0; b < 256; ++b) {
+    m_bytes[b] += histogram[b] * stats->fileSize();
+  }
+
+  /* the top three values in order, ties go to the lower byte */
+  uint8_t top[3] = {0, 0, 0};
+  for (int rank = 0; rank < 3; ++rank) {
+    double best = -1;
+    for (int b = 0; b < 256; ++b) {
+      if (histogram[b] > best && (rank < 1 || b != top[0]) && (rank < 2 || b != top[1])) {
+        best = histogram[b];
+        top[rank] = uint8_t(b);
+      }
+    }
+  }
+  addProfile(top);
+}
+
+double CorpusStats::entropyQuantile(double q) const
+{
+  const uint64_t files = m_fileCount - m_errorCount;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < EntropyBins; ++i) {
+    seen += m_entropy[i];
+    if (files && seen >= q * files) {
+      return (i + 0.5) * 8 / EntropyBins;
+    }
+  }
+  return 0;
+}
+
+uint64_t CorpusStats::sizeQuantile(double q) const
+{
+  const uint64_t files = m_fileCount - m_errorCount;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < SizeBuckets; ++i) {
+    seen += m_sizes[i];
+    if (files && seen >= q * files) {
+      return bucketSize(i);
+    }
+  }
+  return 0;
+}
+
+std::vector<uint64_t> CorpusStats::entropyHistogram(size_t bins) const
+{
+  std::vector<uint64_t> histogram(bins);
+  for (size_t i = 0; i < EntropyBins && bins; ++i) {
+    histogram[i * bins / EntropyBins] += m_entropy[i];
+  }
+  return histogram;
+}
+
+std::vector<uint64_t> CorpusStats::sizeHistogram() const
+{
+  /* the linear steps of each power of two folded together */
+  std::vector<uint64_t> histogram(65);
+  for (size_t i = 0; i < SizeBuckets; ++i) {
+    const uint64_t size = bucketSize(i);
+    size_t bits = 0;
+    while (bits < 64 && size >> bits) {
+      bits++;
+    }
+    histogram[bits] += m_sizes[i];
+  }
+  return histogram;
+}
+
+std::vector<double> CorpusStats::byteFrequency() const
+{
+  std::vector<double> frequency(256);
+  double total = 0;
+  for (int b = 0; b < 256; ++b) {
+    total += m_bytes[b];
+  }
+  for (int b = 0; b < 256 && total > 0; ++b) {
+    frequency[b] = m_bytes[b] / total;
+  }
+  return frequency;
+}
+
+std::vector<CorpusStats::Profile> CorpusStats::topProfiles(size_t count) const
+{
+  std::vector<Profile> profiles = m_profiles;
+  std::sort(profiles.begin(), profiles.end(), moreFrequent);
+  profiles.resize(std::min(count, profiles.size()));
+  return profiles;
+}
+
+size_t CorpusStats::sizeBucket(uint64_t size)
+{
+  /* exact below 16, then 16 steps per power of two */
+  if (size < SizeSteps) {
+    return size_t(size);
+  }
+  size_t bits = 4;
+  while (bits < 63 && size >> (bits + 1)) {
+    bits++;
+  }
+  return SizeSteps + (bits - 4) * SizeSteps + size_t((size >> (bits - 4)) & (SizeSteps - 1));
+}
+
+uint64_t CorpusStats::bucketSize(size_t bucket)
+{
+  /* the smallest size in the bucket */
+  if (bucket < SizeSteps) {
+    return bucket;
+  }
+  const size_t bits = 4 + (bucket - SizeSteps) / SizeSteps;
+  const uint64_t step = (bucket - SizeSteps) % SizeSteps;
+  return (uint64_t(SizeSteps) + step) << (bits - 4);
+}
+
+void CorpusStats::addProfile(const uint8_t* bytes)
+{
+  for (size_t i = 0; i < m_profiles.size(); ++i) {
+    if (!memcmp(m_profiles[i].bytes, bytes, 3)) {
+      m_profiles[i].count++;
+      return;
+    }
+  }
+
+  Profile profile;
+  memcpy(profile.bytes, bytes, 3);
+  profile.count = 1;
+  profile.error = 0;
+  if (m_profiles.size() < ProfileCapacity) {
+    m_profiles.push_back(profile);
+    return;
+  }
+
+  /* full, the new profile takes over the least counted one and inherits its count as error */
+  std::vector<Profile>::iterator least = m_profiles.begin();
+  for (std::vector<Profile>::iterator i = m_profiles.begin(); i != m_profiles.end(); ++i) {
+    if (i->count < least->count) {
+      least = i;
+    }
+  }
+  profile.error = least->count;
+  profile.count = least->count + 1;
+  *least = profile;
+}
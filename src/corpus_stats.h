@@ -0,0 +1,65 @@
+#ifndef __CORPUS_STATS_H__
+#define __CORPUS_STATS_H__
+
+/* summary of every target's stats in a scan, in memory that doesn't grow with the number of files. */
+/* distributions are kept as fixed histograms fine enough to read quantiles from, the most common byte */
+/* profiles by a space saving sketch, so counts of rare profiles are upper bounds */
+
+#include "file_stats.h"
+#include <boost/shared_ptr.hpp>
+#include <vector>
+#include <stdint.h>
+
+class CorpusStats
+{
+public:
+
+  typedef boost::shared_ptr<CorpusStats> Ref;
+
+  /* the three most frequent byte values of a file, most frequent first */
+  struct Profile
+  {
+    uint8_t bytes[3];
+    uint64_t count;
+    uint64_t error; /* count may be over by up to this */
+  };
+
+  ~CorpusStats();
+  CorpusStats();
+
+  void reset();
+  void add(FileStats::Ref stats); /* complete stats only, once per target */
+
+  uint64_t fileCount() const {return m_fileCount;}
+  uint64_t errorCount() const {return m_errorCount;}
+  uint64_t approximateCount() const {return m_approximateCount;}
+  uint64_t totalBytes() const {return m_totalBytes;}
+
+  double entropyQuantile(double q) const; /* to within 1/128 bit */
+  uint64_t sizeQuantile(double q) const; /* to within 1/16 of the size */
+
+  std::vector<uint64_t> entropyHistogram(size_t bins) const; /* files per equal share of 0 to 8 bits */
+  std::vector<uint64_t> sizeHistogram() const; /* files per power of two, index n holds sizes below 2^n */
+
+  std::vector<double> byteFrequency() const; /* over all bytes of the corpus */
+  std::vector<Profile> topProfiles(size_t count) const;
+
+private:
+
+  static size_t sizeBucket(uint64_t size);
+  static uint64_t bucketSize(size_t bucket);
+  void addProfile(const uint8_t* bytes);
+
+  uint64_t m_fileCount;
+  uint64_t m_errorCount;
+  uint64_t m_approximateCount;
+  uint64_t m_totalBytes;
+
+  std::vector<uint64_t> m_entropy; /* 1024 bins over 0 to 8 bits */
+  std::vector<uint64_t> m_sizes; /* 16 linear steps per power of two */
+  std::vector<double> m_bytes; /* byte counts, estimated for sampled files */
+  std::vector<Profile> m_profiles;
+
+};
+
+#endif // __CORPUS_STATS_H__
@@ -0,0 +1,98 @@
+#include "entropy_pyramid.h"
+#include "entropy_table.h"
+#include <algorithm>
+
+namespace {
+
+const uint64_t MinCellSize = 64 * 1024;
+const uint64_t MaxCellSize = 1ULL << 31; /* a cell of one byte value still fits its 32-bit count */
+const uint64_t MaxCells = 2048;
+
+uint64_t finestCellSize(uint64_t fileSize)
+{
+  uint64_t cellSize = MinCellSize;
+  while ((fileSize + cellSize - 1) / cellSize > MaxCells) {
+    cellSize *= 2;
+  }
+  return cellSize;
+}
+
+}
+
+EntropyPyramid::~EntropyPyramid()
+{
+}
+
+EntropyPyramid::EntropyPyramid(uint64_t fileSize) : m_fileSize(fileSize), m_cellSize(finestCellSize(fileSize))
+{
+  const size_t cellCount = size_t((fileSize + m_cellSize - 1) / m_cellSize);
+  m_levels.push_back(std::vector<uint32_t>(std::max<size_t>(1, cellCount) * 256));
+}
+
+bool EntropyPyramid::isUseful(uint64_t fileSize)
+{
+  const uint64_t cellSize = finestCellSize(fileSize);
+  return (fileSize + cellSize - 1) / cellSize > 256 && cellSize <= MaxCellSize;
+}
+
+void EntropyPyramid::add(size_t cell, const uint64_t* counts)
+{
+  uint32_t* cellCounts = &m_levels[0][cell * 256];
+  for (int b = 0; b < 256; ++b) {
+    cellCounts[b] += uint32_t(counts[b]);
+  }
+}
+
+void EntropyPyramid::build()
+{
+  m_levels.resize(1);
+  uint64_t cellSize = m_cellSize;
+  while (m_levels.back().size() > 256 * 256 && cellSize * 2 <= MaxCellSize) {
+    const std::vector<uint32_t>& below = m_levels.back();
+    const size_t belowCells = below.size() / 256;
+    std::vector<uint32_t> level((belowCells + 1) / 2 * 256);
+    for (size_t i = 0; i < belowCells; ++i) {
+      for (int b = 0; b < 256; ++b) {
+        level[i / 2 * 256 + b] += below[i * 256 + b];
+      }
+    }
+    m_levels.push_back(level);
+    cellSize *= 2;
+  }
+}
+
+std::vector<double> EntropyPyramid::entropy(uint64_t begin, uint64_t end, size_t points) const
+{
+  end = std::min(end, m_fileSize);
+  if (begin >= end || !points) {
+    return std::vector<double>();
+  }
+
+  /* each coarser level doubles the cell size */
+  const uint64_t pointSize = std::max<uint64_t>(1, (end - begin) / points);
+  size_t level = 0;
+  while (level + 1 < m_levels.size() && (m_cellSize << (level + 1)) <= pointSize) {
+    level++;
+  }
+  const uint64_t cellSize = m_cellSize << level;
+  const std::vector<uint32_t>& cells = m_levels[level];
+  const size_t cellCount = cells.size() / 256;
+
+  std::vector<double> entropy(points);
+  for (size_t p = 0; p < points; ++p) {
+    /* every cell the point overlaps, points narrower than a cell share it with their neighbours */
+    const uint64_t pointBegin = begin + (end - begin) * p / points;
+    const uint64_t pointEnd = std::max(pointBegin + 1, begin + (end - begin) * (p + 1) / points);
+    const size_t first = size_t(pointBegin / cellSize);
+    const size_t last = std::min(cellCount - 1, size_t((pointEnd - 1) / cellSize));
+
+    uint64_t counts[256] = {0};
+    for (size_t c = first; c <= last; ++c) {
+      for (int b = 0; b < 256; ++b) {
+        counts[b] += cells[c * 256 + b];
+      }
+    }
+    entropy[p] = EntropyTable::entropy(counts, 256);
+  }
+  return entropy;
+}
@@ -0,0 +1,47 @@
+#ifndef __ENTROPY_PYRAMID_H__
+#define __ENTROPY_PYRAMID_H__
+
+/* byte counts of a file in fixed size cells, with each coarser level summing pairs of cells of the one */
+/* below. the entropy of any byte range can be computed from the stored counts without reading the file */
+/* again, so the 1d graph can zoom past the 256 slices of FileStats */
+
+#include <boost/shared_ptr.hpp>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+class EntropyPyramid
+{
+public:
+
+  typedef boost::shared_ptr<EntropyPyramid> Ref;
+
+  ~EntropyPyramid();
+  EntropyPyramid(uint64_t fileSize);
+
+  /* files that fit in 256 cells gain nothing over the slices, very large files would overflow the counts */
+  static bool isUseful(uint64_t fileSize);
+
+  uint64_t fileSize() const {return m_fileSize;}
+  uint64_t cellSize() const {return m_cellSize;} /* of the finest level */
+  size_t cellCount() const {return m_levels[0].size() / 256;}
+
+  /* 256 counts per cell, finest level first */
+  uint32_t* cells() {return &m_levels[0][0];}
+  const uint32_t* cells() const {return &m_levels[0][0];}
+
+  void add(size_t cell, const uint64_t* counts); /* into the finest level */
+  void build(); /* sum the coarser levels once every cell is in */
+
+  /* entropy of points equal parts of [begin, end), from the coarsest level that has a cell per point */
+  std::vector<double> entropy(uint64_t begin, uint64_t end, size_t points) const;
+
+private:
+
+  uint64_t m_fileSize;
+  uint64_t m_cellSize;
+  std::vector<std::vector<uint32_t> > m_levels;
+
+};
+
+#endif // __ENTROPY_PYRAMID_H__
@@ -0,0 +1,13 @@
+#include "entropy_table.h"
+
+double EntropyTable::s_nlogn[EntropyTable::Size];
+const bool EntropyTable::s_filled = EntropyTable::fill(); /* before main, so before any stats thread */
+
+bool EntropyTable::fill()
+{
+  s_nlogn[0] = 0;
+  for (size_t n = 1; n < Size; ++n) {
+    s_nlogn[n] = double(n) * log2(double(n));
+  }
+  return true;
+}
@@ -0,0 +1,53 @@
+#ifndef __ENTROPY_TABLE_H__
+#define __ENTROPY_TABLE_H__
+
+/* shannon entropy straight from integer counts, H = log2(N) - sum(n log2 n) / N, so there is one */
+/* division and one log per distribution. n log2 n of the small counts that dominate comes from a table */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+
+class EntropyTable
+{
+public:
+
+  static double nlogn(uint64_t n)
+  {
+    return n < Size ? s_nlogn[n] : double(n) * log2(double(n));
+  }
+
+  /* in bits, 0 for an empty distribution */
+  template <typename T> static double entropy(const T* counts, size_t bins)
+  {
+    uint64_t total = 0;
+    double weighted = 0;
+    for (size_t i = 0; i < bins; ++i) {
+      total += counts[i];
+      weighted += nlogn(counts[i]);
+    }
+    return entropy(total, weighted);
+  }
+
+  /* from a total and its sum of n log2 n, for callers that accumulate both themselves */
+  static double entropy(uint64_t total, double weighted)
+  {
+    if (!total) {
+      return 0;
+    }
+    const double h = log2(double(total)) - weighted / double(total);
+    return h > 0 ? h : 0; /* rounding can leave a single value distribution just below 0 */
+  }
+
+private:
+
+  static const size_t Size = 4096; /* 32k, stays in cache next to the counts */
+
+  static bool fill();
+
+  static double s_nlogn[Size];
+  static const bool s_filled;
+
+};
+
+#endif // __ENTROPY_TABLE_H__
@@ -0,0 +1,149 @@
+#include "file_reader.h"
+#include <boost/make_shared.hpp>
+#include <algorithm>
+#ifndef WIN32
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/stat.h>
+#endif
+
+namespace {
+
+const size_t BlockSize = 4 * 1024 * 1024;
+const size_t BlockAlignment = 4096;
+
+}
+
+FileReader::~FileReader()
+{
+#ifndef WIN32
+  if (m_fd >= 0) {
+    close(m_fd);
+  }
+#endif
+}
+
+FileReader::FileReader(const std::string& filename, bool sequential) : m_open(false), m_error(false), m_size(0), m_offset(0), m_block(0)
+{
+#ifdef WIN32
+  m_stream = boost::make_shared<std::ifstream>(filename.c_str(), std::ios::binary);
+  if (!m_stream->is_open()) {
+    return;
+  }
+  m_stream->seekg(0, std::ios_base::end);
+  m_size = m_stream->tellg();
+  m_stream->seekg(0, std::ios_base::beg);
+  m_open = true;
+#else
+  m_fd = open(filename.c_str(), O_RDONLY);
+  if (m_fd < 0) {
+    return;
+  }
+  m_open = true;
+
+  struct stat info;
+  if (fstat(m_fd, &info) == 0 && S_ISREG(info.st_mode)) {
+    m_size = info.st_size;
+    posix_fadvise(m_fd, 0, 0, sequential ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_RANDOM);
+  } else {
+    /* block devices report their size through seeking, pipes have none */
+    const off_t end = lseek(m_fd, 0, SEEK_END);
+    m_size = end > 0 ? end : 0;
+    lseek(m_fd, 0, SEEK_SET);
+  }
+#endif
+
+  m_buffer = std::vector<uint8_t>(BlockSize + BlockAlignment);
+  m_block = &m_buffer[0] + (BlockAlignment - (uintptr_t)&m_buffer[0] % BlockAlignment) % BlockAlignment;
+}
+
+bool FileReader::seek(uint64_t offset)
+{
+  if (!m_open) {
+    return false;
+  }
+#ifdef WIN32
+  m_stream->clear();
+  m_stream->seekg(offset, std::ios_base::beg);
+  if (*m_stream) {
+    m_offset = offset;
+    return true;
+  }
+#else
+  if (lseek(m_fd, offset, SEEK_SET) == off_t(offset)) {
+    m_offset = offset;
+    return true;
+  }
+#endif
+
+  /* not seekable, read up to the offset */
+  while (m_offset < offset) {
+    const uint8_t* data;
+    if (!next(data, size_t(std::min<uint64_t>(BlockSize, offset - m_offset)))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+size_t FileReader::next(const uint8_t*& data, size_t maxSize)
+{
+  if (!m_open || m_error) {
+    return 0;
+  }
+
+  const size_t size = readBlock(std::min(maxSize, BlockSize));
+  data = m_block;
+  m_offset += size;
+  return size;
+}
+
+bool FileReader::findHole(uint64_t offset, uint64_t& holeBegin, uint64_t& holeEnd)
+{
+#if !defined(WIN32) && defined(SEEK_HOLE) && defined(SEEK_DATA)
+  if (!m_open || offset >= m_size) {
+    return false;
+  }
+
+  /* every file ends in an implicit hole at its size, which isn't one */
+  const off_t hole = lseek(m_fd, offset, SEEK_HOLE);
+  const bool found = hole >= 0 && uint64_t(hole) < m_size;
+  if (found) {
+    const off_t data = lseek(m_fd, hole, SEEK_DATA);
+    holeBegin = hole;
+    holeEnd = data >= 0 ? std::min<uint64_t>(data, m_size) : m_size; /* no data after it, the hole runs to the end */
+  }
+
+  /* reads go through the descriptor's position */
+  lseek(m_fd, m_offset, SEEK_SET);
+  return found;
+#else
+  return false;
+#endif
+}
+
+size_t FileReader::readBlock(size_t maxSize)
+{
+#ifdef WIN32
+  m_stream->read((char*)m_block, maxSize);
+  if (m_stream->bad()) {
+    m_error = true;
+  }
+  return m_stream->gcount();
+#else
+  /* fill the block, short reads are normal for pipes and devices */
+  size_t size = 0;
+  while (size < maxSize) {
+    const ssize_t count = read(m_fd, m_block + size, maxSize - size);
+    if (count < 0) {
+      m_error = true;
+      break;
+    }
+    if (count == 0) {
+      break;
+    }
+    size += count;
+  }
+  return size;
+#endif
+}
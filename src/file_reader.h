@@ -0,0 +1,55 @@
+#ifndef __FILE_READER_H__
+#define __FILE_READER_H__
+
+/* reads in large page aligned blocks, with the access pattern passed on to the kernel's read ahead. */
+/* a file truncated while it is read only comes up short, which the callers report as an access error */
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+class FileReader : boost::noncopyable
+{
+public:
+
+  ~FileReader();
+  FileReader(const std::string& filename, bool sequential = true); /* sequential false for scattered reads */
+
+  bool isOpen() const {return m_open;}
+  bool error() const {return m_error;}
+  uint64_t size() const {return m_size;}
+
+  /* only moves forward when the file can't be positioned */
+  bool seek(uint64_t offset);
+
+  /* up to maxSize bytes at the cursor, valid until the next call. 0 at the end of the file or on error */
+  size_t next(const uint8_t*& data, size_t maxSize);
+
+  /* the first hole of a sparse file at or after offset, a run of zeros that takes no space on disk. */
+  /* false if there is none or the file system can't tell. doesn't move the cursor */
+  bool findHole(uint64_t offset, uint64_t& holeBegin, uint64_t& holeEnd);
+
+private:
+
+  size_t readBlock(size_t maxSize);
+
+  bool m_open;
+  bool m_error;
+  uint64_t m_size;
+  uint64_t m_offset;
+
+#ifdef WIN32
+  boost::shared_ptr<std::ifstream> m_stream;
+#else
+  int m_fd;
+#endif
+  std::vector<uint8_t> m_buffer;
+  uint8_t* m_block; /* aligned start within m_buffer */
+
+};
+
+#endif // __FILE_READER_H__
@@ -1,86 +1,449 @@
 #include "file_stats.h"
+#include "trigram_histogram.h"
+#include "file_reader.h"
+#include "entropy_pyramid.h"
+#include "entropy_table.h"
 #include <boost/foreach.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+#include <boost/algorithm/string.hpp>
+#include <QtCore/QCryptographicHash>
 #include <iostream>
-#include <fstream>
 #include <algorithm>
+#include <limits>
+#include <string.h>
 #include <math.h>
 
-double hlog(const double x)
+namespace {
+
+struct DigestInfo
 {
-  if (x == 0) {
-    return 0;
-  }
-  return log2(x);
+  FileStats::DigestType type;
+  const char* name;
+  const char* setting;
+  QCryptographicHash::Algorithm algorithm;
+};
+
+const DigestInfo DigestInfos[] = {
+  {FileStats::DigestMd5, "MD5", "md5", QCryptographicHash::Md5},
+  {FileStats::DigestSha1, "SHA-1", "sha1", QCryptographicHash::Sha1},
+  {FileStats::DigestSha256, "SHA-256", "sha256", QCryptographicHash::Sha256}
+};
+
+const size_t DigestCount = sizeof(DigestInfos) / sizeof(DigestInfos[0]);
+
 }
 
-double calcEntropy(const std::vector<double>& d)
+void countBytes(const uint8_t* data, size_t size, uint64_t* counts)
 {
-  double h = 0;
-  BOOST_FOREACH(double x, d) {
-    h += x * hlog(x);
+  /* short runs aren't worth setting up the banks for */
+  if (size < 1024) {
+    for (size_t i = 0; i < size; ++i) {
+      counts[data[i]]++;
+    }
+    return;
+  }
+
+  /* four interleaved banks, so a run of one byte value doesn't stall on its own previous increment. */
+  /* 32-bit counters are enough as the caller never passes more than one block */
+  uint32_t banks[4][256];
+  memset(banks, 0, sizeof(banks));
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    banks[0][word & 0xff]++;
+    banks[1][(word >> 8) & 0xff]++;
+    banks[2][(word >> 16) & 0xff]++;
+    banks[3][(word >> 24) & 0xff]++;
+    banks[0][(word >> 32) & 0xff]++;
+    banks[1][(word >> 40) & 0xff]++;
+    banks[2][(word >> 48) & 0xff]++;
+    banks[3][word >> 56]++;
+  }
+  for (; i < size; ++i) {
+    banks[0][data[i]]++;
+  }
+  for (int b = 0; b < 256; ++b) {
+    counts[b] += uint64_t(banks[0][b]) + banks[1][b] + banks[2][b] + banks[3][b];
   }
-  return -h;
 }
 
-FileStats::FileStats(const std::string& filename, const boost::atomic<bool>& abort) : m_filename(filename), m_accessError(false)
+FileStats::FileStats(const std::string& filename, const boost::atomic<bool>& abort, uint64_t sampleBudget, const ProgressCallback& onProgress, unsigned digests) :
+  m_filename(filename), m_totalEntropy(0), m_fileSize(0), m_accessError(false), m_approximate(false), m_sampledBytes(0), m_entropyError(0), m_progress(1)
 {
   if (abort) {
     m_accessError = true;
     return;
   }
 
-  std::vector<uint8_t> buffer(1024 * 1024);
-  std::ifstream file(filename.c_str(), std::ios::binary);
-  if (!file.is_open()) {
-    m_accessError = true;
-    return;
+  {
+    FileReader file(filename);
+    if (!file.isOpen()) {
+      m_accessError = true;
+      return;
+    }
+    m_fileSize = file.size();
+  }
+
+  if (sampleBudget && m_fileSize / 16 > sampleBudget) {
+    computeSampled(filename, sampleBudget, abort);
+  } else {
+    computeExact(filename, abort, onProgress, digests);
+  }
+}
+
+FileStats::FileStats(const std::string& filename) :
+  m_filename(filename), m_totalEntropy(0), m_fileSize(0), m_accessError(false), m_approximate(false), m_sampledBytes(0), m_entropyError(0), m_progress(1)
+{
+}
+
+/* collects what the chunks have done so far and publishes it at a bounded rate */
+class FileStats::Progress
+{
+public:
+
+  Progress(const std::string& filename, uint64_t fileSize, uint64_t samplesPerSlice, const std::vector<Chunk>& chunks, const ProgressCallback& onProgress) :
+    m_filename(filename), m_fileSize(fileSize), m_samplesPerSlice(samplesPerSlice), m_onProgress(onProgress),
+    m_histograms(chunks.size(), std::vector<uint64_t>(256)), m_slices(chunks.size()), m_bytes(chunks.size()),
+    m_last(boost::posix_time::microsec_clock::universal_time())
+  {
+    BOOST_FOREACH(const Chunk& chunk, chunks) {
+      m_firstSlice.push_back(chunk.begin / samplesPerSlice);
+    }
+  }
+
+  void update(size_t chunk, const std::vector<uint64_t>& histogram, const std::vector<double>& slices, uint64_t bytes)
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_histograms[chunk] = histogram;
+    m_slices[chunk] = slices;
+    m_bytes[chunk] = bytes;
+
+    const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+    if (now - m_last < boost::posix_time::milliseconds(250)) {
+      return;
+    }
+    m_last = now;
+    m_onProgress(snapshot());
   }
 
-  file.seekg(0, std::ios_base::end);
-  m_fileSize = file.tellg();
-  file.seekg(0, std::ios_base::beg);
+private:
 
-  /* histogram buffers */
-  std::vector<double> hg(256);
-  std::vector<double> shg(256);
-  std::vector<double> h3d_buffer(256 * 256 * 256);
-  double (&h3d)[256][256][256] = *(double (*)[256][256][256])&h3d_buffer[0];
+  FileStats::Ref snapshot() const
+  {
+    /* the lock is held */
+    FileStats::Ref stats(new FileStats(m_filename));
+    stats->m_fileSize = m_fileSize;
 
+    std::vector<uint64_t> counts(256);
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < m_histograms.size(); ++i) {
+      for (int b = 0; b < 256; ++b) {
+        counts[b] += m_histograms[i][b];
+      }
+      bytes += m_bytes[i];
+    }
+    if (!bytes) {
+      counts[0] = bytes = 1; /* nothing read yet, avoid dividing by zero */
+    }
+    stats->setHistogram(counts, bytes);
+    stats->m_sampledBytes = bytes;
+    stats->m_progress = std::min(0.999, double(bytes) / std::max<uint64_t>(1, m_fileSize));
+
+    /* each chunk's slices go where they are in the file */
+    const uint64_t sliceTotal = (m_fileSize + m_samplesPerSlice - 1) / m_samplesPerSlice;
+    stats->m_entropy1d = std::vector<double>(size_t(sliceTotal));
+    for (size_t i = 0; i < m_slices.size(); ++i) {
+      for (size_t j = 0; j < m_slices[i].size() && m_firstSlice[i] + j < sliceTotal; ++j) {
+        stats->m_entropy1d[size_t(m_firstSlice[i] + j)] = m_slices[i][j];
+      }
+    }
+    return stats;
+  }
+
+  std::string m_filename;
+  uint64_t m_fileSize;
+  uint64_t m_samplesPerSlice;
+  ProgressCallback m_onProgress;
+
+  boost::mutex m_mutex;
+  std::vector<std::vector<uint64_t> > m_histograms;
+  std::vector<std::vector<double> > m_slices;
+  std::vector<uint64_t> m_bytes;
+  std::vector<uint64_t> m_firstSlice;
+  boost::posix_time::ptime m_last;
+
+};
+
+/* hashes the blocks the chunks read on a thread of its own, so the file is read once. hashes need */
+/* the bytes in order, a chunk ahead of the hash keeps copies of its blocks and waits when it has */
+/* too many. only the hash reaches the zeros of a hole, they are never read */
+class FileStats::DigestFeed
+{
+public:
+
+  DigestFeed(unsigned digests, size_t chunkCount, const boost::atomic<bool>& abort) : m_abort(abort), m_open(chunkCount), m_frontier(0), m_failed(false)
+  {
+    for (size_t i = 0; i < DigestCount; ++i) {
+      if (digests & DigestInfos[i].type) {
+        m_hashes[DigestInfos[i].name] = boost::make_shared<QCryptographicHash>(DigestInfos[i].algorithm);
+      }
+    }
+  }
+
+  /* a block read at position by the chunk that starts at chunkBegin, null data is a hole. */
+  /* false once the digests can't be completed, the chunk may stop then */
+  bool add(uint64_t chunkBegin, uint64_t position, const uint8_t* data, size_t size)
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    uint64_t& buffered = m_buffered[chunkBegin];
+    const size_t bytes = data ? size : 0;
+    while (!m_failed && !m_abort && buffered && buffered + bytes > limit(chunkBegin)) {
+      m_changed.wait(lock);
+    }
+    if (m_failed || m_abort) {
+      return false;
+    }
+    Block& block = m_blocks[position];
+    block.chunkBegin = chunkBegin;
+    block.size = size;
+    block.hole = !data;
+    if (data) {
+      block.data.assign(data, data + size);
+    }
+    buffered += bytes;
+    m_changed.notify_all();
+    return true;
+  }
+
+  /* a chunk handed over all it will, complete false if it stopped short of its end */
+  void close(bool complete)
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_open--;
+    m_failed |= !complete;
+    m_changed.notify_all();
+  }
+
+  void run()
+  {
+    /* in a stats thread, next to the chunks */
+    boost::mutex::scoped_lock lock(m_mutex);
+    while (!m_failed && !m_abort) {
+      std::map<uint64_t, Block>::iterator next = m_blocks.find(m_frontier);
+      if (next == m_blocks.end()) {
+        if (!m_open) {
+          m_failed = !m_blocks.empty(); /* blocks past a gap, the chunks don't line up */
+          return;
+        }
+        m_changed.wait(lock);
+        continue;
+      }
+
+      std::vector<uint8_t> data;
+      data.swap(next->second.data);
+      const Block block = next->second;
+      m_blocks.erase(next);
+
+      lock.unlock();
+      typedef std::pair<const std::string, boost::shared_ptr<QCryptographicHash> > Hash;
+      BOOST_FOREACH(const Hash& hash, m_hashes) {
+        addToHash(*hash.second, block.hole ? 0 : &data[0], block.size);
+      }
+      lock.lock();
+
+      m_frontier += block.size;
+      m_buffered[block.chunkBegin] -= data.size();
+      m_changed.notify_all();
+    }
+  }
+
+  /* once run has returned, false if the digests are incomplete */
+  bool result(Digests& digests) const
+  {
+    if (m_failed || m_abort) {
+      return false;
+    }
+    typedef std::pair<const std::string, boost::shared_ptr<QCryptographicHash> > Hash;
+    BOOST_FOREACH(const Hash& hash, m_hashes) {
+      digests[hash.first] = hash.second->result().toHex().toStdString();
+    }
+    return true;
+  }
+
+private:
+
+  struct Block
+  {
+    uint64_t chunkBegin;
+    size_t size;
+    bool hole;
+    std::vector<uint8_t> data;
+  };
+
+  /* the chunk being hashed only needs enough to keep the hash busy, the ones after it */
+  /* keep reading until they have this much ahead of it */
+  uint64_t limit(uint64_t chunkBegin) const
+  {
+    return chunkBegin <= m_frontier ? 8 * 1024 * 1024 : 64 * 1024 * 1024;
+  }
+
+  const boost::atomic<bool>& m_abort;
+  std::map<std::string, boost::shared_ptr<QCryptographicHash> > m_hashes;
+
+  boost::mutex m_mutex;
+  boost::condition_variable m_changed;
+  std::map<uint64_t, Block> m_blocks; /* by position, waiting to be hashed */
+  std::map<uint64_t, uint64_t> m_buffered; /* bytes held in m_blocks by chunk begin */
+  size_t m_open; /* chunks still reading */
+  uint64_t m_frontier; /* everything before this is hashed */
+  bool m_failed;
+
+};
+
+void FileStats::computeExact(const std::string& filename, const boost::atomic<bool>& abort, const ProgressCallback& onProgress, unsigned digests)
+{
   /* divide the file into slices to generate entropy graphs */
   const uint64_t sliceCount = 256;
-  const uint64_t samplesPerSlice = m_fileSize / sliceCount;
-  uint64_t sampleCount = 0;
+  const uint64_t samplesPerSlice = std::max<uint64_t>(1, m_fileSize / sliceCount);
+
+  /* split large files into chunks of whole slices, so slice entropies need no merging. */
+  /* each chunk has its own trigram counts, and a chunk this big always counts them in the flat */
+  /* 64MB array. the budget caps the chunk count, so a file peaks at 128MB of trigram counters */
+  const uint64_t minChunkSize = 16 * 1024 * 1024;
+  const uint64_t denseTrigramSize = 64 * 1024 * 1024;
+  const uint64_t trigramBudget = 128 * 1024 * 1024;
+  const uint64_t maxChunks = std::max<uint64_t>(1, std::min<uint64_t>(trigramBudget / denseTrigramSize, boost::thread::hardware_concurrency()));
+  const uint64_t chunkCount = std::max<uint64_t>(1, std::min(maxChunks, m_fileSize / minChunkSize));
+  const uint64_t slicesPerChunk = (m_fileSize / samplesPerSlice + chunkCount - 1) / chunkCount;
 
-  /* keep track of the last three bytes */
-  uint8_t bytes[3];
-  uint64_t byteCount = 0;
+  std::vector<Chunk> chunks(chunkCount);
+  for (uint64_t i = 0; i < chunkCount; ++i) {
+    chunks[i].begin = i * slicesPerChunk * samplesPerSlice;
+    chunks[i].end = i + 1 < chunkCount ? (i + 1) * slicesPerChunk * samplesPerSlice : std::numeric_limits<uint64_t>::max();
+    chunks[i].index = size_t(i);
+  }
+  /* cells don't line up with chunks, a cell split between two chunks is summed when merging */
+  if (EntropyPyramid::isUseful(m_fileSize)) {
+    m_pyramid = boost::make_shared<EntropyPyramid>(m_fileSize);
+  }
+  const uint64_t cellSize = m_pyramid ? m_pyramid->cellSize() : 0;
+
+  boost::shared_ptr<Progress> progress;
+  if (onProgress) {
+    progress = boost::make_shared<Progress>(filename, m_fileSize, samplesPerSlice, boost::cref(chunks), onProgress);
+  }
 
-  while (!file.eof()) {
-    file.read((char*)&buffer[0], buffer.size());
-    for (size_t i = 0; i < file.gcount(); ++i) {
-      bytes[0] = bytes[1];
-      bytes[1] = bytes[2];
-      bytes[2] = buffer[i];
+  /* the first chunk runs on the calling thread, the chunks pass what they read on to the digests */
+  boost::thread_group threads;
+  boost::shared_ptr<DigestFeed> digestFeed;
+  if (digests) {
+    digestFeed = boost::make_shared<DigestFeed>(digests, chunks.size(), boost::cref(abort));
+    threads.create_thread(boost::bind(&DigestFeed::run, digestFeed.get()));
+  }
+  for (size_t i = 1; i < chunks.size(); ++i) {
+    threads.create_thread(boost::bind(&FileStats::computeChunk, boost::cref(filename), m_fileSize, samplesPerSlice, cellSize, boost::ref(chunks[i]), progress.get(), digestFeed.get(), boost::cref(abort)));
+  }
+  computeChunk(filename, m_fileSize, samplesPerSlice, cellSize, chunks[0], progress.get(), digestFeed.get(), abort);
+  threads.join_all();
+  Digests digestResult;
+  const bool digestError = digestFeed && !digestFeed->result(digestResult);
+
+  /* merge in file order */
+  std::vector<uint64_t> hg(256);
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    if (chunks[i].accessError || digestError || abort) {
+      /* allow user to cancel long running operation */
+      m_accessError = true;
+      m_pyramid.reset();
+      return;
+    }
+    for (size_t c = 0; c < chunks[i].cells.size() / 256; ++c) {
+      m_pyramid->add(size_t(chunks[i].firstCell + c), &chunks[i].cells[c * 256]);
+    }
+    for (int b = 0; b < 256; ++b) {
+      hg[b] += chunks[i].histogram[b];
+    }
+    m_entropy1d.insert(m_entropy1d.end(), chunks[i].entropy1d.begin(), chunks[i].entropy1d.end());
+    if (i) {
+      chunks[0].trigrams->merge(*chunks[i].trigrams);
+      chunks[i].trigrams.reset();
+    }
+  }
 
-      /* update 3d histrogram */
-      if (++byteCount >= 3) {
-        h3d[bytes[0]][bytes[1]][bytes[2]]++;
+  m_digests = digestResult;
+  setTrigrams(*chunks[0].trigrams);
+  setHistogram(hg, m_fileSize);
+  m_sampledBytes = m_fileSize;
+  if (m_pyramid) {
+    m_pyramid->build();
+  }
+}
+
+void FileStats::computeSampled(const std::string& filename, uint64_t sampleBudget, const boost::atomic<bool>& abort)
+{
+  /* stratified sampling: every slice gets the same number of blocks, each at a random offset */
+  /* within its own share of the slice. the generator is seeded by the size so results repeat */
+  FileReader file(filename, false);
+  if (!file.isOpen()) {
+    m_accessError = true;
+    return;
+  }
+
+  const uint64_t sliceCount = 256;
+  const uint64_t blockSize = 64 * 1024;
+  const uint64_t blocksPerSlice = std::max<uint64_t>(1, sampleBudget / blockSize / sliceCount);
+  const uint64_t sliceSize = m_fileSize / sliceCount;
+  const uint64_t stratumSize = sliceSize / blocksPerSlice;
+  boost::random::mt19937 random(uint32_t(m_fileSize ^ (m_fileSize >> 32)));
+
+  /* blocks are dealt round robin into batches, the spread of the batch entropies bounds the error */
+  const size_t batchCount = 16;
+  std::vector<std::vector<uint64_t> > batches(batchCount, std::vector<uint64_t>(256));
+  size_t blockIndex = 0;
+
+  std::vector<uint64_t> hg(256);
+  TrigramHistogram h3d(sliceCount * blocksPerSlice * blockSize);
+  for (uint64_t slice = 0; slice < sliceCount; ++slice) {
+    std::vector<uint64_t> shg(256);
+    uint64_t sampleCount = 0;
+    for (uint64_t k = 0; k < blocksPerSlice; ++k, ++blockIndex) {
+      const uint64_t span = stratumSize > blockSize ? stratumSize - blockSize : 0;
+      const uint64_t offset = slice * sliceSize + k * stratumSize + boost::random::uniform_int_distribution<uint64_t>(0, span)(random);
+      const uint8_t* data;
+      const size_t size = file.seek(offset) ? file.next(data, size_t(blockSize)) : 0;
+      if (!size) {
+        m_accessError = true;
+        return;
       }
 
-      /* update other histograms */
-      hg[buffer[i]]++;
-      shg[buffer[i]]++;
+      /* trigrams inside the block only */
+      uint32_t trigram = (data[0] << 8) | (size > 1 ? data[1] : 0);
+      for (size_t i = 2; i < size; ++i) {
+        trigram = ((trigram << 8) | data[i]) & 0xffffff;
+        h3d.add(trigram);
+      }
 
-      /* track slices and reset if needed */
-      if (++sampleCount >= samplesPerSlice) {
-        BOOST_FOREACH(double& x, shg) {
-          x /= sampleCount;
-        }
-        m_entropy1d.push_back(calcEntropy(shg));
-        shg = std::vector<double>(256);
-        sampleCount = 0;
+      std::vector<uint64_t> bhg(256);
+      countBytes(data, size, &bhg[0]);
+      for (int b = 0; b < 256; ++b) {
+        shg[b] += bhg[b];
+        batches[blockIndex % batchCount][b] += bhg[b];
       }
+      sampleCount += size;
+    }
+
+    m_entropy1d.push_back(EntropyTable::entropy(&shg[0], 256));
+    for (int b = 0; b < 256; ++b) {
+      hg[b] += shg[b];
     }
+    m_sampledBytes += sampleCount;
+
     if (abort) {
       /* allow user to cancel long running operation */
       m_accessError = true;
@@ -88,37 +451,201 @@ FileStats::FileStats(const std::string& filename, const boost::atomic<bool>& abo
     }
   }
 
-  /* trailing bytes of 1d histogram */
-  if (sampleCount) {
-    BOOST_FOREACH(double& x, shg) {
-      x /= sampleCount;
+  setTrigrams(h3d);
+  setHistogram(hg, m_sampledBytes);
+
+  /* batch means: the full sample varies about 1/sqrt(batches) as much as one batch */
+  double mean = 0, squares = 0;
+  BOOST_FOREACH(const std::vector<uint64_t>& batch, batches) {
+    const double h = EntropyTable::entropy(&batch[0], 256);
+    mean += h;
+    squares += h * h;
+  }
+  mean /= batchCount;
+  const double variance = std::max(0.0, (squares - batchCount * mean * mean) / (batchCount - 1));
+  m_entropyError = 1.96 * sqrt(variance / batchCount);
+  m_approximate = true;
+}
+
+namespace {
+
+template <typename T> void put(std::string& data, T value)
+{
+  data.append((const char*)&value, sizeof(value));
+}
+
+template <typename T> bool get(const std::string& data, size_t& offset, T& value)
+{
+  if (data.size() - offset < sizeof(value)) {
+    return false;
+  }
+  memcpy(&value, data.data() + offset, sizeof(value));
+  offset += sizeof(value);
+  return true;
+}
+
+void putString(std::string& data, const std::string& value)
+{
+  put<uint8_t>(data, uint8_t(value.size()));
+  data += value;
+}
+
+bool getString(const std::string& data, size_t& offset, std::string& value)
+{
+  uint8_t size;
+  if (!get(data, offset, size) || data.size() - offset < size) {
+    return false;
+  }
+  value = data.substr(offset, size);
+  offset += size;
+  return true;
+}
+
+}
+
+bool FileStats::hasDigests(unsigned types) const
+{
+  for (size_t i = 0; i < DigestCount; ++i) {
+    if ((types & DigestInfos[i].type) && !m_digests.count(DigestInfos[i].name)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+unsigned FileStats::parseDigests(const std::string& names)
+{
+  std::vector<std::string> parts;
+  boost::split(parts, names, boost::is_any_of(", "), boost::token_compress_on);
+  unsigned digests = 0;
+  BOOST_FOREACH(const std::string& part, parts) {
+    for (size_t i = 0; i < DigestCount; ++i) {
+      if (boost::iequals(part, DigestInfos[i].setting) || boost::iequals(part, DigestInfos[i].name)) {
+        digests |= DigestInfos[i].type;
+      }
+    }
+  }
+  return digests;
+}
+
+std::vector<double> FileStats::entropyRange(uint64_t begin, uint64_t end, size_t points) const
+{
+  return m_pyramid ? m_pyramid->entropy(begin, end, points) : std::vector<double>();
+}
+
+std::string FileStats::serialize() const
+{
+  /* native byte order, the cache is local to this machine. the 2d map is stored sparsely */
+  std::string data;
+  put<uint64_t>(data, m_fileSize);
+  put<double>(data, m_totalEntropy);
+  put<uint8_t>(data, m_approximate);
+  put<uint64_t>(data, m_sampledBytes);
+  put<double>(data, m_entropyError);
+  BOOST_FOREACH(double x, m_histogram) {
+    put<double>(data, x);
+  }
+  put<uint32_t>(data, uint32_t(m_entropy1d.size()));
+  BOOST_FOREACH(double x, m_entropy1d) {
+    put<double>(data, x);
+  }
+  put<uint32_t>(data, uint32_t(m_entropy2d.size() - std::count(m_entropy2d.begin(), m_entropy2d.end(), 0.0)));
+  for (size_t i = 0; i < m_entropy2d.size(); ++i) {
+    if (m_entropy2d[i] != 0) {
+      put<uint16_t>(data, uint16_t(i));
+      put<double>(data, m_entropy2d[i]);
+    }
+  }
+  put<uint8_t>(data, uint8_t(m_digests.size()));
+  for (Digests::const_iterator i = m_digests.begin(); i != m_digests.end(); ++i) {
+    putString(data, i->first);
+    putString(data, i->second);
+  }
+  put<uint32_t>(data, m_pyramid ? uint32_t(m_pyramid->cellCount()) : 0);
+  if (m_pyramid) {
+    data.append((const char*)m_pyramid->cells(), m_pyramid->cellCount() * 256 * sizeof(uint32_t));
+  }
+  return data;
+}
+
+FileStats::Ref FileStats::deserialize(const std::string& filename, const std::string& data)
+{
+  Ref stats(new FileStats(filename));
+  size_t offset = 0;
+  uint8_t approximate;
+  uint32_t count;
+  if (!get(data, offset, stats->m_fileSize) || !get(data, offset, stats->m_totalEntropy) || !get(data, offset, approximate) ||
+      !get(data, offset, stats->m_sampledBytes) || !get(data, offset, stats->m_entropyError)) {
+    return Ref();
+  }
+  stats->m_approximate = approximate != 0;
+
+  stats->m_histogram = std::vector<double>(256);
+  BOOST_FOREACH(double& x, stats->m_histogram) {
+    if (!get(data, offset, x)) {
+      return Ref();
+    }
+  }
+
+  if (!get(data, offset, count) || count > (data.size() - offset) / sizeof(double)) {
+    return Ref();
+  }
+  stats->m_entropy1d = std::vector<double>(count);
+  BOOST_FOREACH(double& x, stats->m_entropy1d) {
+    get(data, offset, x);
+  }
+
+  if (!get(data, offset, count) || count > 256 * 256) {
+    return Ref();
+  }
+  stats->m_entropy2d = std::vector<double>(256 * 256);
+  for (uint32_t i = 0; i < count; ++i) {
+    uint16_t index;
+    if (!get(data, offset, index) || !get(data, offset, stats->m_entropy2d[index])) {
+      return Ref();
+    }
+  }
+
+  uint8_t digestCount;
+  if (!get(data, offset, digestCount)) {
+    return Ref();
+  }
+  for (uint8_t i = 0; i < digestCount; ++i) {
+    std::string name, hex;
+    if (!getString(data, offset, name) || !getString(data, offset, hex)) {
+      return Ref();
+    }
+    stats->m_digests[name] = hex;
+  }
+
+  /* the finest pyramid level, coarser levels are summed again */
+  if (!get(data, offset, count)) {
+    return Ref();
+  }
+  if (count) {
+    stats->m_pyramid = boost::make_shared<EntropyPyramid>(stats->m_fileSize);
+    const size_t size = stats->m_pyramid->cellCount() * 256 * sizeof(uint32_t);
+    if (count != stats->m_pyramid->cellCount() || data.size() - offset < size) {
+      return Ref();
     }
-    m_entropy1d.push_back(calcEntropy(shg));
+    memcpy(stats->m_pyramid->cells(), data.data() + offset, size);
+    offset += size;
+    stats->m_pyramid->build();
   }
+  return offset == data.size() ? stats : Ref();
+}
 
+void FileStats::setTrigrams(const TrigramHistogram& trigrams)
+{
   /* project the 3d histogram so we can display it in 2d */
   double maxEntropy = 0;
+  const std::vector<double> lanes = trigrams.laneEntropy();
   m_entropy2d = std::vector<double>(256 * 256);
   for (int x = 0; x < 256; ++x) {
     for (int y = 0; y < 256; ++y) {
-      /* calculate normalizing constant */
-      double z = 0;
-      for (int i = 0; i < 256; ++i) {
-        z += h3d[x][y][i];
-      }
-
-      if (z == 0) {
-        continue;
-      }
-
-      /* entropy of this lane */
-      double h = 0;
-      for (int i = 0; i < 256; ++i) {
-        double k = h3d[x][y][i] / z;
-        h += k * hlog(k);
-      }
-      m_entropy2d[y*256+x] = -h;
-      maxEntropy = std::max(maxEntropy, -h);
+      const double h = lanes[x*256+y];
+      m_entropy2d[y*256+x] = h;
+      maxEntropy = std::max(maxEntropy, h);
     }
   }
 
@@ -129,10 +656,201 @@ FileStats::FileStats(const std::string& filename, const boost::atomic<bool>& abo
     }
   }
 
+}
+
+void FileStats::setHistogram(const std::vector<uint64_t>& counts, uint64_t total)
+{
   /* entropy of the whole file */
-  BOOST_FOREACH(double& x, hg) {
-    x /= m_fileSize;
+  m_histogram = std::vector<double>(256);
+  for (int b = 0; b < 256; ++b) {
+    m_histogram[b] = double(counts[b]) / total;
+  }
+  m_totalEntropy = EntropyTable::entropy(&counts[0], 256);
+}
+
+void FileStats::computeChunk(const std::string& filename, uint64_t fileSize, uint64_t samplesPerSlice, uint64_t cellSize, Chunk& chunk, Progress* progress, DigestFeed* digests, const boost::atomic<bool>& abort)
+{
+  /* in a stats thread */
+  readChunk(filename, fileSize, samplesPerSlice, cellSize, chunk, progress, digests, abort);
+  if (digests) {
+    digests->close(!chunk.accessError && !abort);
+  }
+}
+
+void FileStats::readChunk(const std::string& filename, uint64_t fileSize, uint64_t samplesPerSlice, uint64_t cellSize, Chunk& chunk, Progress* progress, DigestFeed* digests, const boost::atomic<bool>& abort)
+{
+  chunk.accessError = false;
+  chunk.histogram = std::vector<uint64_t>(256);
+  chunk.firstCell = 0;
+  if (cellSize && chunk.begin < fileSize) {
+    chunk.firstCell = chunk.begin / cellSize;
+    chunk.cells = std::vector<uint64_t>(size_t((std::min(chunk.end, fileSize) - 1) / cellSize - chunk.firstCell + 1) * 256);
+  }
+
+  FileReader file(filename);
+  if (!file.isOpen()) {
+    chunk.accessError = true;
+    return;
+  }
+
+  /* the two bytes before the chunk start its first trigram, as in a serial pass */
+  uint32_t trigram = 0;
+  uint64_t byteCount = std::min<uint64_t>(2, chunk.begin);
+  if (!file.seek(chunk.begin - byteCount)) {
+    chunk.accessError = true;
+    return;
+  }
+  const uint8_t* data;
+  for (uint64_t i = 0; i < byteCount; ++i) {
+    if (!file.next(data, 1)) {
+      chunk.accessError = true;
+      return;
+    }
+    trigram = (trigram << 8) | data[0];
+  }
+
+  chunk.trigrams = boost::make_shared<TrigramHistogram>(std::min(chunk.end, fileSize) - std::min(chunk.begin, fileSize));
+
+  /* bytes are counted into chg up to each slice or cell boundary, then folded into both */
+  std::vector<uint64_t> shg(256);
+  std::vector<uint64_t> chg(256);
+  uint64_t sampleCount = 0;
+  uint64_t remaining = chunk.end - chunk.begin;
+  uint64_t position = chunk.begin;
+
+  /* small blocks so an abort is noticed quickly, the data is not copied either way. */
+  /* holes of sparse files are zeros that were never written, they are counted without being read */
+  const size_t blockSize = 256 * 1024;
+  const size_t holeStep = 64 * 1024 * 1024;
+  uint64_t holeBegin = 0;
+  uint64_t holeEnd = 0;
+  while (remaining) {
+    if (position >= holeEnd && !file.findHole(position, holeBegin, holeEnd)) {
+      holeBegin = holeEnd = std::numeric_limits<uint64_t>::max();
+    }
+
+    size_t size;
+    if (position >= holeBegin) {
+      size = size_t(std::min<uint64_t>(holeStep, std::min(remaining, holeEnd - position)));
+      data = 0;
+      if (!file.seek(position + size)) {
+        chunk.accessError = true;
+        return;
+      }
+    } else {
+      size = file.next(data, size_t(std::min<uint64_t>(blockSize, std::min(remaining, holeBegin - position))));
+      if (!size) {
+        break;
+      }
+    }
+    remaining -= size;
+    if (digests && !digests->add(chunk.begin, position, data, size)) {
+      return; /* the result is dropped without its digests */
+    }
+
+    /* update 3d histrogram */
+    if (data) {
+      for (size_t i = 0; i < size; ++i) {
+        trigram = ((trigram << 8) | data[i]) & 0xffffff;
+        if (++byteCount >= 3) {
+          chunk.trigrams->add(trigram);
+        }
+      }
+    } else {
+      /* once three zeros are in, every further trigram is zero */
+      size_t i = 0;
+      for (; i < size && i < 3; ++i) {
+        trigram = (trigram << 8) & 0xffffff;
+        if (++byteCount >= 3) {
+          chunk.trigrams->add(trigram);
+        }
+      }
+      if (i < size) {
+        chunk.trigrams->add(0, size - i);
+        byteCount += size - i;
+      }
+    }
+
+    /* update slice histogram up to each slice boundary, folding finished slices into the chunk histogram */
+    for (size_t i = 0; i < size;) {
+      size_t count = size_t(std::min<uint64_t>(size - i, samplesPerSlice - sampleCount));
+      if (cellSize) {
+        count = size_t(std::min<uint64_t>(count, cellSize - position % cellSize));
+      }
+      if (data) {
+        countBytes(data + i, count, &chg[0]);
+      } else {
+        chg[0] += count;
+      }
+      sampleCount += count;
+      position += count;
+      i += count;
+      if (sampleCount >= samplesPerSlice || (cellSize && position % cellSize == 0)) {
+        foldCell(chunk, cellSize, position - 1, chg, shg);
+      }
+      if (sampleCount >= samplesPerSlice) {
+        chunk.entropy1d.push_back(EntropyTable::entropy(&shg[0], 256));
+        for (int b = 0; b < 256; ++b) {
+          chunk.histogram[b] += shg[b];
+        }
+        shg.assign(256, 0);
+        sampleCount = 0;
+      }
+    }
+
+    if (abort) {
+      return;
+    }
+
+    if (progress) {
+      std::vector<uint64_t> histogram = chunk.histogram;
+      for (int b = 0; b < 256; ++b) {
+        histogram[b] += shg[b] + chg[b];
+      }
+      progress->update(chunk.index, histogram, chunk.entropy1d, chunk.end - chunk.begin - remaining);
+    }
+  }
+  if (file.error() || position < std::min(chunk.end, fileSize)) {
+    chunk.accessError = true; /* unreadable, or truncated while it was read */
+    return;
+  }
+
+  /* trailing bytes of 1d histogram, only the last chunk has any */
+  if (sampleCount) {
+    foldCell(chunk, cellSize, position - 1, chg, shg);
+    chunk.entropy1d.push_back(EntropyTable::entropy(&shg[0], 256));
+    for (int b = 0; b < 256; ++b) {
+      chunk.histogram[b] += shg[b];
+    }
+  }
+}
+
+void FileStats::foldCell(Chunk& chunk, uint64_t cellSize, uint64_t position, std::vector<uint64_t>& chg, std::vector<uint64_t>& shg)
+{
+  /* position is any byte of the cell chg was counted in, past the cells if the file grew while it was read */
+  const size_t index = cellSize ? size_t(position / cellSize - chunk.firstCell) : 0;
+  uint64_t* cell = index < chunk.cells.size() / 256 ? &chunk.cells[index * 256] : 0;
+  for (int b = 0; b < 256; ++b) {
+    shg[b] += chg[b];
+    if (cell) {
+      cell[b] += chg[b];
+    }
+  }
+  chg.assign(256, 0);
+}
+
+void FileStats::addToHash(QCryptographicHash& hash, const uint8_t* data, size_t size)
+{
+  if (data) {
+    hash.addData((const char*)data, int(size));
+    return;
+  }
+
+  /* a hole, hashed from zeros in memory */
+  static const std::vector<char> zeros(64 * 1024);
+  while (size) {
+    const size_t count = std::min(size, zeros.size());
+    hash.addData(&zeros[0], int(count));
+    size -= count;
   }
-  m_totalEntropy = calcEntropy(hg);
-  m_histogram = hg;
 }
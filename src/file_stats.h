@@ -3,16 +3,35 @@
 
 #include <boost/shared_ptr.hpp>
 #include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <string>
 #include <vector>
+#include <map>
 #include <stdint.h>
 
+class TrigramHistogram;
+class EntropyPyramid;
+class QCryptographicHash;
+
 class FileStats
 {
 public:
 
   typedef boost::shared_ptr<FileStats> Ref;
+  typedef boost::function<void (Ref snapshot)> ProgressCallback; /* called from stats threads */
+  typedef std::map<std::string, std::string> Digests; /* algorithm name to lowercase hex */
+
+  enum DigestType
+  {
+    DigestMd5 = 1,
+    DigestSha1 = 2,
+    DigestSha256 = 4
+  };
 
-  FileStats(const std::string& filename, const boost::atomic<bool>& abort);
+  /* files over 16 times the sample budget are estimated from that many bytes, 0 always reads everything. */
+  /* while a large file is read, partial snapshots are passed to onProgress a few times a second. */
+  /* digests is a mask of DigestType, hashed in the same pass so only exact stats have them */
+  FileStats(const std::string& filename, const boost::atomic<bool>& abort, uint64_t sampleBudget = 0, const ProgressCallback& onProgress = ProgressCallback(), unsigned digests = 0);
   const std::vector<double>& entropy1d() const {return m_entropy1d;}
   const std::vector<double>& entropy2d() const {return m_entropy2d;}
   const std::vector<double>& histogram() const {return m_histogram;}
@@ -21,15 +40,71 @@ public:
   uint64_t fileSize() const {return m_fileSize;}
   bool accessError() const {return m_accessError;}
 
+  bool isApproximate() const {return m_approximate;}
+  uint64_t sampledBytes() const {return m_sampledBytes;}
+  double entropyError() const {return m_entropyError;} /* 95% confidence half width of totalEntropy, in bits */
+
+  /* snapshots have the bytes read so far, slices not reached yet are 0 and there is no 2d map */
+  bool isPartial() const {return m_progress < 1;}
+  double progress() const {return m_progress;}
+
+  const Digests& digests() const {return m_digests;}
+  bool hasDigests(unsigned types) const;
+  static unsigned parseDigests(const std::string& names); /* comma separated, as in the settings */
+
+  /* exact stats of large files keep finer byte counts, so the 1d graph can zoom into any range */
+  bool canZoom() const {return m_pyramid.get() != 0;}
+  std::vector<double> entropyRange(uint64_t begin, uint64_t end, size_t points) const;
+
+  /* compact binary form for the stats cache, deserialize returns null on malformed data */
+  std::string serialize() const;
+  static Ref deserialize(const std::string& filename, const std::string& data);
+
 private:
 
+  FileStats(const std::string& filename);
+
+  class Progress;
+  class DigestFeed;
+
+  /* a run of whole slices, computed on its own thread */
+  struct Chunk
+  {
+    uint64_t begin;
+    uint64_t end;
+    std::vector<uint64_t> histogram;
+    std::vector<double> entropy1d;
+    boost::shared_ptr<TrigramHistogram> trigrams;
+    std::vector<uint64_t> cells; /* 256 counts per pyramid cell from firstCell, empty without a pyramid */
+    uint64_t firstCell;
+    size_t index;
+    bool accessError;
+  };
+
+  void computeExact(const std::string& filename, const boost::atomic<bool>& abort, const ProgressCallback& onProgress, unsigned digests);
+  void computeSampled(const std::string& filename, uint64_t sampleBudget, const boost::atomic<bool>& abort);
+  static void computeChunk(const std::string& filename, uint64_t fileSize, uint64_t samplesPerSlice, uint64_t cellSize, Chunk& chunk, Progress* progress, DigestFeed* digests, const boost::atomic<bool>& abort);
+  static void readChunk(const std::string& filename, uint64_t fileSize, uint64_t samplesPerSlice, uint64_t cellSize, Chunk& chunk, Progress* progress, DigestFeed* digests, const boost::atomic<bool>& abort);
+
+  static void addToHash(QCryptographicHash& hash, const uint8_t* data, size_t size); /* null data is a hole of zeros */
+  static void foldCell(Chunk& chunk, uint64_t cellSize, uint64_t position, std::vector<uint64_t>& chg, std::vector<uint64_t>& shg);
+
+  void setTrigrams(const TrigramHistogram& trigrams);
+  void setHistogram(const std::vector<uint64_t>& counts, uint64_t total);
+
   std::vector<double> m_entropy1d;
   std::vector<double> m_entropy2d; /* 256x256 */
   std::vector<double> m_histogram;
+  Digests m_digests;
+  boost::shared_ptr<EntropyPyramid> m_pyramid;
   std::string m_filename;
   double m_totalEntropy;
   uint64_t m_fileSize;
   bool m_accessError;
+  bool m_approximate;
+  uint64_t m_sampledBytes;
+  double m_entropyError;
+  double m_progress;
 
 };
 
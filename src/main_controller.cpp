@@ -1,8 +1,9 @@
 #include "main_controller.h"
 #include <boost/make_shared.hpp>
 #include <boost/foreach.hpp>
+#include <algorithm>
 
-MainController::MainController(int argc, char* argv[], boost::asio::io_service& io) : m_io(io), m_haveRuleset(false), m_scanning(false), m_statsRemaining(0)
+MainController::MainController(int argc, char* argv[], boost::asio::io_service& io) : m_io(io), m_haveRuleset(false), m_scanning(false)
 {
   m_settings = boost::make_shared<Settings>();
 
@@ -11,15 +12,23 @@ MainController::MainController(int argc, char* argv[], boost::asio::io_service&
   m_rm->onScanComplete.connect(boost::bind(&MainController::handleScanComplete, this, _1));
   m_rm->onRulesUpdated.connect(boost::bind(&MainController::handleRulesUpdated, this));
 
-  m_sc = boost::make_shared<StatsCalculator>(boost::ref(io));
+  m_corpus = boost::make_shared<CorpusStats>();
+
+  m_sc = boost::make_shared<StatsCalculator>(boost::ref(io), m_settings);
   m_sc->onFileStats.connect(boost::bind(&MainController::handleFileStats, this, _1));
+  m_sc->onFileStatsProgress.connect(boost::bind(&MainController::handleFileStatsProgress, this, _1));
 
   m_mainWindow = boost::make_shared<MainWindow>(boost::ref(io), m_settings);
   m_mainWindow->onChangeTargets.connect(boost::bind(&MainController::handleChangeTargets, this, _1));
   m_mainWindow->onChangeRuleset.connect(boost::bind(&MainController::handleChangeRuleset, this, _1));
+  m_mainWindow->onChangeRuleFilter.connect(boost::bind(&MainController::handleChangeRuleFilter, this, _1));
   m_mainWindow->onRequestRuleWindowOpen.connect(boost::bind(&MainController::handleRequestRuleWindowOpen, this));
   m_mainWindow->onRequestAboutWindowOpen.connect(boost::bind(&MainController::handleAboutWindowOpen, this));
+  m_mainWindow->onRequestSummaryWindowOpen.connect(boost::bind(&MainController::handleSummaryWindowOpen, this));
   m_mainWindow->onScanAbort.connect(boost::bind(&MainController::handleUserScanAbort, this));
+  m_mainWindow->onRequestExactStats.connect(boost::bind(&MainController::handleRequestExactStats, this, _1));
+  m_mainWindow->onVisibleTargets.connect(boost::bind(&MainController::handleVisibleTargets, this, _1));
+  m_mainWindow->onSelectTarget.connect(boost::bind(&MainController::handleSelectTarget, this, _1, _2));
 
   m_mainWindow->setRules(m_rm->getRules());
 
@@ -48,12 +57,20 @@ void MainController::handleChangeRuleset(RulesetView::Ref ruleset)
   scan();
 }
 
+void MainController::handleChangeRuleFilter(const std::string& filter)
+{
+  m_ruleFilter = filter;
+  if (m_haveRuleset) {
+    scan();
+  }
+}
+
 void MainController::handleScanResult(const std::string& target, ScannerRule::Ref rule, RulesetView::Ref view)
 {
-  if (!rule) {
+  if (!rule && !m_settings->getStatsOnDemand()) {
     /* scan of this target complete, compute stats for it */
-    m_statsRemaining++;
-    m_sc->getStats(target);
+    m_statsPending.insert(target);
+    m_sc->getStats(target, m_settings->getStatsSampleBudget());
   }
   m_mainWindow->addScanResult(target, rule, view);
 }
@@ -74,6 +91,11 @@ void MainController::handleRulesUpdated()
     updateCompileWindows(rule);
   }
 
+  /* rules may have been rebuilt in the background after being edited */
+  if (m_ruleWindow && m_ruleWindow->isVisible()) {
+    m_ruleWindow->updateCompileState(rules);
+  }
+
   if (!m_scanning) {
     setCompileWindowsEnabled(true);
     m_mainWindow->setCompilerBusy(false);
@@ -82,9 +104,116 @@ void MainController::handleRulesUpdated()
 
 void MainController::handleFileStats(FileStats::Ref stats)
 {
-  m_statsRemaining--;
+  /* an exact request from the target panel is merged into the scan's job if that hasn't started yet, */
+  /* otherwise it reports separately */
+  m_statsPrefetched.erase(stats->filename());
+  m_statsRequested.erase(stats->filename()); /* once the window lets it go, selecting it again reads the cache or retries */
   m_mainWindow->updateFileStats(stats);
-  handleOperationsComplete();
+  if (m_settings->getStatsOnDemand()) {
+    /* only the first result, a later exact pass would count the target twice */
+    if (m_corpusTargets.insert(stats->filename()).second) {
+      addToCorpus(stats);
+    }
+  } else if (m_statsPending.erase(stats->filename())) {
+    /* only the scan's own result, for the same reason */
+    addToCorpus(stats);
+    handleOperationsComplete();
+  }
+}
+
+void MainController::addToCorpus(FileStats::Ref stats)
+{
+  m_corpus->add(stats);
+  if (m_summaryWindow && m_summaryWindow->isVisible()) {
+    m_summaryWindow->refresh();
+  }
+}
+
+void MainController::handleFileStatsProgress(FileStats::Ref stats)
+{
+  m_mainWindow->updateFileStats(stats);
+}
+
+void MainController::handleRequestExactStats(const std::string& target)
+{
+  if (!m_scanning && m_statsPending.empty()) {
+    m_sc->reset(); /* a previous abort would cancel it straight away */
+  }
+  selectStats(target, std::vector<std::string>());
+  m_sc->getStats(target, 0, StatsCalculator::PrioritySelected);
+}
+
+void MainController::handleVisibleTargets(const std::vector<std::string>& targets)
+{
+  m_sc->setPriority(targets, StatsCalculator::PriorityVisible);
+}
+
+void MainController::handleSelectTarget(const std::string& target, const std::vector<std::string>& following)
+{
+  selectStats(target, following);
+  if (!m_settings->getStatsOnDemand()) {
+    if (m_statsPending.count(target)) {
+      m_sc->setPriority(std::vector<std::string>(1, target), StatsCalculator::PrioritySelected);
+      return;
+    }
+    /* the window keeps a few recent stats, older ones are read back from the cache */
+    if (m_mainWindow->hasFileStats(target)) {
+      return;
+    }
+    if (!m_scanning && m_statsPending.empty()) {
+      m_sc->reset(); /* a previous abort would cancel it straight away */
+    }
+    m_sc->getStats(target, m_settings->getStatsSampleBudget(), StatsCalculator::PrioritySelected);
+    return;
+  }
+
+  if (!m_scanning && m_statsPending.empty()) {
+    m_sc->reset(); /* a previous abort would cancel it straight away */
+  }
+
+  /* prefetches the selection has moved away from are abandoned */
+  std::set<std::string> wanted(following.begin(), following.end());
+  wanted.insert(target);
+  std::set<std::string>::iterator i = m_statsPrefetched.begin();
+  while (i != m_statsPrefetched.end()) {
+    if (!wanted.count(*i)) {
+      m_sc->cancel(*i);
+      m_statsRequested.erase(*i);
+      m_statsPrefetched.erase(i++);
+    } else {
+      ++i;
+    }
+  }
+
+  const uint64_t sampleBudget = m_settings->getStatsSampleBudget();
+  if (!m_mainWindow->hasFileStats(target) && m_statsRequested.insert(target).second) {
+    m_sc->getStats(target, sampleBudget, StatsCalculator::PrioritySelected);
+  }
+  m_sc->setPriority(std::vector<std::string>(1, target), StatsCalculator::PrioritySelected);
+  m_statsPrefetched.erase(target);
+
+  BOOST_FOREACH(const std::string& next, following) {
+    if (!m_mainWindow->hasFileStats(next) && m_statsRequested.insert(next).second) {
+      m_statsPrefetched.insert(next);
+      m_sc->getStats(next, sampleBudget);
+    }
+  }
+}
+
+void MainController::selectStats(const std::string& target, const std::vector<std::string>& following)
+{
+  /* the selection moved away, its job is dropped unless the scan or a prefetch still needs it */
+  const std::string previous = m_statsSelected;
+  m_statsSelected = target;
+  if (previous.empty() || previous == target || m_statsPending.count(previous)) {
+    return;
+  }
+  if (std::find(following.begin(), following.end(), previous) != following.end()) {
+    return;
+  }
+  m_sc->cancel(previous);
+  m_statsRequested.erase(previous);
+  m_statsPrefetched.erase(previous);
 }
 
 void MainController::handleRequestRuleWindowOpen()
@@ -129,6 +258,15 @@ void MainController::handleAboutWindowOpen()
   }
 }
 
+void MainController::handleSummaryWindowOpen()
+{
+  if (m_summaryWindow && m_summaryWindow->isVisible()) {
+    m_summaryWindow->raise();
+  } else {
+    m_summaryWindow = boost::make_shared<SummaryWindow>(m_corpus, m_settings->getStatsOnDemand(), m_mainWindow->geometry());
+  }
+}
+
 void MainController::handleUserScanAbort()
 {
   m_rm->scanAbort();
@@ -137,7 +275,7 @@ void MainController::handleUserScanAbort()
 
 void MainController::handleOperationsComplete()
 {
-  if (m_scanning || m_statsRemaining) {
+  if (m_scanning || !m_statsPending.empty()) {
     return; /* not done yet */
   }
 
@@ -160,7 +298,25 @@ void MainController::scan()
     m_scanning = true;
     m_mainWindow->scanBegin();
     m_sc->reset();
-    m_rm->scan(m_targets, m_ruleset);
+
+    /* stats still pending from the last scan are superseded by this one */
+    BOOST_FOREACH(const std::string& target, m_statsPending) {
+      m_sc->cancel(target);
+    }
+    BOOST_FOREACH(const std::string& target, m_statsPrefetched) {
+      m_sc->cancel(target);
+    }
+    m_statsPending.clear();
+    m_statsRequested.clear();
+    m_statsPrefetched.clear();
+    m_statsSelected.clear();
+    m_corpus->reset();
+    m_corpusTargets.clear();
+    if (m_summaryWindow && m_summaryWindow->isVisible()) {
+      m_summaryWindow->refresh();
+    }
+
+    m_rm->scan(m_targets, m_ruleset, RuleSelector(m_ruleFilter));
     if (m_ruleWindow) {
       m_ruleWindow->setEnabled(false);
     }
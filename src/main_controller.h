@@ -7,11 +7,14 @@
 #include "rule_window.h"
 #include "compile_window.h"
 #include "about_window.h"
+#include "summary_window.h"
+#include "corpus_stats.h"
 #include "settings.h"
 #include "ruleset_manager.h"
 #include "stats_calculator.h"
 #include <boost/asio.hpp>
 #include <boost/shared_ptr.hpp>
+#include <set>
 
 class MainController
 {
@@ -23,12 +26,17 @@ private:
 
   void handleChangeTargets(const std::vector<std::string>& files);
   void handleChangeRuleset(RulesetView::Ref ruleset);
+  void handleChangeRuleFilter(const std::string& filter);
 
   void handleScanResult(const std::string& target, ScannerRule::Ref rule, RulesetView::Ref view);
   void handleScanComplete(const std::string& error);
   void handleRulesUpdated();
 
   void handleFileStats(FileStats::Ref stats);
+  void handleFileStatsProgress(FileStats::Ref stats);
+  void handleRequestExactStats(const std::string& target);
+  void handleVisibleTargets(const std::vector<std::string>& targets);
+  void handleSelectTarget(const std::string& target, const std::vector<std::string>& following);
 
   void handleRequestRuleWindowOpen();
   void handleRuleWindowSave(const std::vector<RulesetView::Ref>& rules);
@@ -36,8 +44,11 @@ private:
 
   void handleCompileWindowRecompile(RulesetView::Ref view);
   void handleAboutWindowOpen();
+  void handleSummaryWindowOpen();
   void handleUserScanAbort();
 
+  void selectStats(const std::string& target, const std::vector<std::string>& following);
+  void addToCorpus(FileStats::Ref stats);
   void handleOperationsComplete();
   void scan();
   void updateCompileWindows(const RulesetView::Ref& rule);
@@ -51,13 +62,20 @@ private:
   boost::shared_ptr<MainWindow> m_mainWindow;
   boost::shared_ptr<RuleWindow> m_ruleWindow;
   boost::shared_ptr<AboutWindow> m_aboutWindow;
+  boost::shared_ptr<SummaryWindow> m_summaryWindow;
   std::list<CompileWindow::Ref> m_compileWindows;
 
   std::vector<std::string> m_targets;
   RulesetView::Ref m_ruleset;
+  std::string m_ruleFilter; /* selector expression, empty to scan with every rule */
   bool m_haveRuleset;
   bool m_scanning;
-  int m_statsRemaining;
+  std::set<std::string> m_statsPending; /* scanned targets waiting for their stats */
+  std::set<std::string> m_statsRequested; /* on demand mode, targets selected or prefetched and not reported yet */
+  std::set<std::string> m_statsPrefetched; /* on demand mode, prefetches that may not be needed any more */
+  std::string m_statsSelected; /* target of the last selected priority request */
+  CorpusStats::Ref m_corpus; /* every scanned target's stats, summed up. on demand only those computed so far */
+  std::set<std::string> m_corpusTargets; /* on demand mode, targets already in the corpus */
 
 };
 
@@ -3,13 +3,21 @@
 #include <boost/make_shared.hpp>
 #include <boost/assign.hpp>
 #include <iostream>
+#include <set>
 #include <QtWidgets/QFileDialog>
 #include <QtWidgets/QMenu>
+#include <QtWidgets/QScrollBar>
 #include <QtGui/QDragEnterEvent>
 #include <QtGui/QDropEvent>
 #include <QtGui/QClipboard>
 #include <QtCore/QMimeData>
 
+namespace {
+
+const size_t RecentStats = 16; /* kept stats besides the targets computed ahead of the selection */
+
+}
+
 #ifdef WIN32
   #undef min
   #undef max
@@ -41,6 +49,10 @@ MainWindow::MainWindow(boost::asio::io_service& io, boost::shared_ptr<Settings>
   scanDirectory->setIcon(QIcon(":/glyphicons-441-folder-closed.png"));
   connect(scanDirectory, SIGNAL(triggered()), this, SLOT(handleTargetDirectoryBrowse()));
 
+  QAction* summary = menu->addAction("Scan &Summary");
+  summary->setIcon(QIcon(":/glyphicons-42-charts.png"));
+  connect(summary, SIGNAL(triggered()), this, SLOT(handleSummaryMenu()));
+
   menu->addSeparator();
   QAction* about = menu->addAction("&About");
   about->setIcon(QIcon(":/glyphicons-196-info-sign.png"));
@@ -51,6 +63,7 @@ MainWindow::MainWindow(boost::asio::io_service& io, boost::shared_ptr<Settings>
 
   connect(m_ui.targetButton, SIGNAL(released()), this, SLOT(handleTargetFileBrowse()));
   connect(m_ui.ruleButton, SIGNAL(released()), this, SLOT(handleRuleFileBrowse()));
+  connect(m_ui.ruleFilter, SIGNAL(editingFinished()), this, SLOT(handleRuleFilterEdited()));
 
   m_ui.tree->setColumnCount(2);
   m_ui.tree->header()->hide();
@@ -58,6 +71,8 @@ MainWindow::MainWindow(boost::asio::io_service& io, boost::shared_ptr<Settings>
   m_ui.tree->header()->setSectionResizeMode(1, QHeaderView::Stretch);
   m_ui.tree->header()->setStretchLastSection(false);
   connect(m_ui.tree, SIGNAL(itemSelectionChanged()), this, SLOT(treeItemSelectionChanged()));
+  connect(m_ui.tree->verticalScrollBar(), SIGNAL(valueChanged(int)), this, SLOT(handleTreeScrolled()));
+  connect(m_ui.tree->verticalScrollBar(), SIGNAL(rangeChanged(int, int)), this, SLOT(handleTreeScrolled()));
 
   /* copy meny for tree view */
   m_copyMenuAction = new QAction("&Copy", this);
@@ -68,6 +83,7 @@ MainWindow::MainWindow(boost::asio::io_service& io, boost::shared_ptr<Settings>
   m_ui.tree->setContextMenuPolicy(Qt::ActionsContextMenu);
 
   m_targetPanel = new TargetPanel(this);
+  m_targetPanel->onRequestExactStats.connect(boost::bind(&MainWindow::handleRequestExactStats, this, _1));
   m_ui.splitter->addWidget(m_targetPanel);
   m_matchPanel = new MatchPanel(this);
   m_ui.splitter->addWidget(m_matchPanel);
@@ -88,6 +104,10 @@ MainWindow::MainWindow(boost::asio::io_service& io, boost::shared_ptr<Settings>
   m_scanTimer = new QTimer(this);
   connect(m_scanTimer, SIGNAL(timeout()), this, SLOT(handleScanTimer()));
 
+  m_visibleTimer = new QTimer(this);
+  m_visibleTimer->setSingleShot(true);
+  connect(m_visibleTimer, SIGNAL(timeout()), this, SLOT(handleVisibleTimer()));
+
   m_status->setText("Drag file into window and select rule to scan");
   show();
 }
@@ -98,7 +118,8 @@ void MainWindow::scanBegin()
   m_targetMap.clear();
   m_scannerRuleMap.clear();
   m_rulesetViewMap.clear();
-  m_fileStats.clear();
+  m_selectedTarget.clear();
+  m_recentStats.clear();
   m_matchPanel->hide();
   m_targetPanel->hide();
   m_ui.tree->clear();
@@ -195,6 +216,8 @@ void MainWindow::addScanResult(const std::string& target, ScannerRule::Ref rule,
     /* set the file icon */
     QFileInfo fileInfo(target.c_str());
     root->setIcon(0, m_iconProvider.icon(fileInfo));
+
+    handleTreeScrolled(); /* new items push others out of view */
   }
 
   if (!rule) {
@@ -226,12 +249,69 @@ void MainWindow::addScanResult(const std::string& target, ScannerRule::Ref rule,
 
 void MainWindow::updateFileStats(FileStats::Ref stats)
 {
-  m_fileStats[stats->filename()] = stats;
+  if (stats->isPartial() && stats->filename() != m_selectedTarget) {
+    return; /* progress is only shown for the selection */
+  }
+  std::list<FileStats::Ref>::iterator known = findStats(stats->filename());
+  if (known != m_recentStats.end()) {
+    if (stats->isPartial() && !(*known)->isPartial()) {
+      return; /* an exact pass over an estimate, keep showing the estimate until it is done */
+    }
+    if (stats->accessError() && !(*known)->isPartial() && !(*known)->accessError()) {
+      return; /* an exact pass was aborted, keep the estimate */
+    }
+    m_recentStats.erase(known);
+  }
+  m_recentStats.push_front(stats);
+
+  /* the least recently used go, but never the selection */
+  if (m_recentStats.size() > RecentStats + m_settings->getStatsPrefetch()) {
+    if (m_recentStats.back()->filename() == m_selectedTarget) {
+      m_recentStats.splice(m_recentStats.begin(), m_recentStats, --m_recentStats.end());
+    }
+    m_recentStats.pop_back();
+  }
+
   if (m_targetPanel->isVisible() && m_targetPanel->filename() == stats->filename()) {
     m_targetPanel->show(stats->filename(), stats);
   }
 }
 
+bool MainWindow::hasFileStats(const std::string& target) const
+{
+  BOOST_FOREACH(const FileStats::Ref& stats, m_recentStats) {
+    if (stats->filename() == target) {
+      return !stats->isPartial();
+    }
+  }
+  return false;
+}
+
+std::list<FileStats::Ref>::iterator MainWindow::findStats(const std::string& target)
+{
+  std::list<FileStats::Ref>::iterator i = m_recentStats.begin();
+  while (i != m_recentStats.end() && (*i)->filename() != target) {
+    ++i;
+  }
+  return i;
+}
+
+FileStats::Ref MainWindow::selectedStats()
+{
+  /* selecting a target makes its stats the most recently used */
+  std::list<FileStats::Ref>::iterator selected = findStats(m_selectedTarget);
+  if (selected == m_recentStats.end()) {
+    return FileStats::Ref();
+  }
+  m_recentStats.splice(m_recentStats.begin(), m_recentStats, selected);
+  return m_recentStats.front();
+}
+
+void MainWindow::handleRequestExactStats(const std::string& target)
+{
+  onRequestExactStats(target);
+}
+
 void MainWindow::handleSelectRuleAllFromMenu()
 {
   /* null pointer means scan with every rule */
@@ -274,7 +354,7 @@ void MainWindow::handleTargetDirectoryBrowse()
 
 void MainWindow::handleRuleFileBrowse()
 {
-  QString file = QFileDialog::getOpenFileName(this, "Select Rule File", QString(), "YARA Rules (*)");
+  QString file = QFileDialog::getOpenFileName(this, "Select Rule File", QString(), "YARA Rules (*);;Compiled YARA Rules (*.yarc)");
   if (!file.isEmpty()) {
     file = QDir::toNativeSeparators(file);
     m_ui.rulePath->setText(file);
@@ -282,6 +362,15 @@ void MainWindow::handleRuleFileBrowse()
   }
 }
 
+void MainWindow::handleRuleFilterEdited()
+{
+  if (!m_ui.ruleFilter->isModified()) {
+    return; /* focus lost without an edit */
+  }
+  m_ui.ruleFilter->setModified(false);
+  onChangeRuleFilter(m_ui.ruleFilter->text().toStdString());
+}
+
 void MainWindow::handleEditRulesMenu()
 {
   onRequestRuleWindowOpen();
@@ -292,6 +381,11 @@ void MainWindow::handleAboutMenu()
   onRequestAboutWindowOpen();
 }
 
+void MainWindow::handleSummaryMenu()
+{
+  onRequestSummaryWindowOpen();
+}
+
 void MainWindow::treeItemSelectionChanged()
 {
   QList<QTreeWidgetItem *> items = m_ui.tree->selectedItems();
@@ -316,8 +410,16 @@ void MainWindow::treeItemSelectionChanged()
   QTreeWidgetItem* selectedItem = items[0];
   if (m_targetMap.find(selectedItem) != m_targetMap.end()) {
     std::string target = m_targetMap[selectedItem];
+    m_selectedTarget = target;
+    std::vector<std::string> following;
+    const int index = m_ui.tree->indexOfTopLevelItem(selectedItem);
+    const int count = std::min(m_ui.tree->topLevelItemCount(), index + 1 + m_settings->getStatsPrefetch());
+    for (int i = index + 1; i < count; ++i) {
+      following.push_back(m_targetMap[m_ui.tree->topLevelItem(i)]);
+    }
+    onSelectTarget(target, following);
     m_matchPanel->hide();
-    m_targetPanel->show(target, m_fileStats[target]);
+    m_targetPanel->show(target, selectedStats());
   } else {
     ScannerRule::Ref rule = m_scannerRuleMap[selectedItem];
     RulesetView::Ref view = m_rulesetViewMap[selectedItem];
@@ -338,6 +440,32 @@ void MainWindow::handleScanTimer()
   m_status->setText(message.c_str());
 }
 
+void MainWindow::handleTreeScrolled()
+{
+  if (!m_visibleTimer->isActive()) {
+    m_visibleTimer->start(1000/10);
+  }
+}
+
+void MainWindow::handleVisibleTimer()
+{
+  /* walk down from the top of the viewport, match rows count as their target */
+  std::vector<std::string> targets;
+  std::set<std::string> seen;
+  const int height = m_ui.tree->viewport()->height();
+  for (QTreeWidgetItem* item = m_ui.tree->itemAt(0, 0); item; item = m_ui.tree->itemBelow(item)) {
+    if (m_ui.tree->visualItemRect(item).top() >= height) {
+      break;
+    }
+    QTreeWidgetItem* root = item->parent() ? item->parent() : item;
+    std::map<QTreeWidgetItem*, std::string>::const_iterator target = m_targetMap.find(root);
+    if (target != m_targetMap.end() && seen.insert(target->second).second) {
+      targets.push_back(target->second);
+    }
+  }
+  onVisibleTargets(targets);
+}
+
 void MainWindow::handleScanAbortButton()
 {
   m_scanTimer->stop();
@@ -386,7 +514,7 @@ void MainWindow::dropEvent(QDropEvent* event)
   if (urls.size() == 1) {
     QFileInfo fileInfo(urls[0].toLocalFile());
     QString file = QDir::toNativeSeparators(fileInfo.absoluteFilePath());
-    if (fileInfo.suffix() == "yar" || fileInfo.suffix() == "yara") {
+    if (fileInfo.suffix() == "yar" || fileInfo.suffix() == "yara" || fileInfo.suffix() == "yarc") {
       m_ui.rulePath->setText(file);
       onChangeRuleset(boost::make_shared<RulesetView>(file.toStdString()));
       event->acceptProposedAction();
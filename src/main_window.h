@@ -15,6 +15,7 @@
 #include <QtWidgets/QLabel>
 #include <QtWidgets/QToolButton>
 #include <QtWidgets/QFileIconProvider>
+#include <list>
 
 class MainWindow : public QMainWindow
 {
@@ -27,9 +28,14 @@ public:
 
   boost::signals2::signal<void (const std::vector<std::string>& files)> onChangeTargets;
   boost::signals2::signal<void (RulesetView::Ref ruleset)> onChangeRuleset;
+  boost::signals2::signal<void (const std::string& filter)> onChangeRuleFilter;
   boost::signals2::signal<void ()> onScanAbort;
   boost::signals2::signal<void ()> onRequestRuleWindowOpen;
   boost::signals2::signal<void ()> onRequestAboutWindowOpen;
+  boost::signals2::signal<void ()> onRequestSummaryWindowOpen;
+  boost::signals2::signal<void (const std::string& target)> onRequestExactStats;
+  boost::signals2::signal<void (const std::vector<std::string>& targets)> onVisibleTargets; /* targets in the tree view, top first */
+  boost::signals2::signal<void (const std::string& target, const std::vector<std::string>& following)> onSelectTarget; /* with the next few targets in tree order */
 
   void scanBegin();
   void scanEnd();
@@ -37,6 +43,7 @@ public:
   void setRules(const std::vector<RulesetView::Ref>& rules);
   void addScanResult(const std::string& target, ScannerRule::Ref rule, RulesetView::Ref view);
   void updateFileStats(FileStats::Ref stats);
+  bool hasFileStats(const std::string& target) const; /* final stats are kept, no need to compute them again */
 
 private slots:
 
@@ -45,10 +52,14 @@ private slots:
   void handleTargetFileBrowse();
   void handleTargetDirectoryBrowse();
   void handleRuleFileBrowse();
+  void handleRuleFilterEdited();
   void handleEditRulesMenu();
   void handleAboutMenu();
+  void handleSummaryMenu();
   void treeItemSelectionChanged();
   void handleScanTimer();
+  void handleTreeScrolled();
+  void handleVisibleTimer();
   void handleScanAbortButton();
   void handleCopyItemClicked();
 
@@ -58,6 +69,7 @@ private:
   void dropEvent(QDropEvent* event);
   void keyPressEvent(QKeyEvent *event);
   void closeEvent(QCloseEvent *event);
+  void handleRequestExactStats(const std::string& target);
 
   boost::asio::io_service& m_io;
   boost::shared_ptr<Settings> m_settings;
@@ -71,6 +83,7 @@ private:
   QSignalMapper* m_signalMapper;
 
   QTimer* m_scanTimer;
+  QTimer* m_visibleTimer; /* collects scrolling and new results into one visible targets update */
   int m_scanPhase;
   bool m_scanAborted;
 
@@ -83,7 +96,11 @@ private:
   std::map<QTreeWidgetItem*, ScannerRule::Ref> m_scannerRuleMap;
   std::map<QTreeWidgetItem*, RulesetView::Ref> m_rulesetViewMap;
 
-  std::map<std::string, FileStats::Ref> m_fileStats;
+  std::list<FileStats::Ref>::iterator findStats(const std::string& target);
+  FileStats::Ref selectedStats();
+
+  std::string m_selectedTarget;
+  std::list<FileStats::Ref> m_recentStats; /* most recently used first, a scan can have any number of targets */
 
 };
 
@@ -0,0 +1,158 @@
+#include "rule_bundle.h"
+#include <boost/make_shared.hpp>
+#include <boost/foreach.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <sstream>
+#include <string.h>
+#include <QtCore/QFile>
+#include <QtCore/QSaveFile>
+
+namespace {
+
+const char BundleMagic[4] = {'Y', 'G', 'R', 'B'};
+const uint32_t BundleVersion = 1;
+
+struct Header
+{
+  char magic[4];
+  uint32_t version;
+  uint64_t manifestSize;
+};
+
+}
+
+RuleBundle::~RuleBundle()
+{
+  if (m_data) {
+    m_file->unmap(m_data);
+  }
+}
+
+RuleBundle::RuleBundle(const std::string& file) : m_data(0), m_dataStart(0)
+{
+  m_file = boost::make_shared<QFile>(file.c_str());
+  if (!m_file->open(QIODevice::ReadOnly) || m_file->size() < qint64(sizeof(Header))) {
+    return;
+  }
+
+  uint8_t* data = m_file->map(0, m_file->size());
+  if (!data) {
+    return;
+  }
+
+  Header header;
+  memcpy(&header, data, sizeof(header));
+  const uint64_t size = m_file->size();
+  if (memcmp(header.magic, BundleMagic, sizeof(BundleMagic)) || header.version != BundleVersion || header.manifestSize > size - sizeof(header)) {
+    m_file->unmap(data);
+    return;
+  }
+
+  /* compiled rules follow the manifest, offsets are relative to there */
+  const uint64_t dataStart = sizeof(header) + header.manifestSize;
+
+  std::stringstream manifest(std::string((const char*)data + sizeof(header), header.manifestSize));
+  boost::property_tree::ptree tree;
+  try {
+    boost::property_tree::json_parser::read_json(manifest, tree);
+  } catch (const std::exception& e) {
+    m_file->unmap(data);
+    return;
+  }
+
+  BOOST_FOREACH(const boost::property_tree::ptree::value_type& item, tree.get_child("rulesets", boost::property_tree::ptree())) {
+    Entry entry;
+    entry.file = item.second.get<std::string>("file", "");
+    entry.name = item.second.get<std::string>("name", "");
+    entry.hash = item.second.get<std::string>("hash", "");
+    BOOST_FOREACH(const boost::property_tree::ptree::value_type& b, item.second.get_child("binaries", boost::property_tree::ptree())) {
+      Binary binary;
+      binary.key = b.second.get<std::string>("key", "");
+      binary.offset = b.second.get<uint64_t>("offset", 0);
+      binary.size = b.second.get<uint64_t>("size", 0);
+      if (binary.offset > size - dataStart || binary.size > size - dataStart - binary.offset) {
+        m_file->unmap(data);
+        m_entries.clear();
+        return; /* truncated bundle */
+      }
+      entry.binaries.push_back(binary);
+    }
+    BOOST_FOREACH(const boost::property_tree::ptree::value_type& rule, item.second.get_child("rules", boost::property_tree::ptree())) {
+      entry.catalog.push_back(rule.second.data());
+    }
+    m_entries.push_back(entry);
+  }
+
+  m_data = data;
+  m_dataStart = dataStart;
+}
+
+const uint8_t* RuleBundle::data(const Binary& binary) const
+{
+  return m_data + m_dataStart + binary.offset;
+}
+
+bool RuleBundle::write(const std::string& file, const std::vector<Entry>& entries, const std::vector<std::vector<char> >& blobs)
+{
+  boost::property_tree::ptree rulesets;
+  uint64_t offset = 0;
+  size_t blob = 0;
+  BOOST_FOREACH(const Entry& entry, entries) {
+    boost::property_tree::ptree item;
+    item.put("file", entry.file);
+    item.put("name", entry.name);
+    item.put("hash", entry.hash);
+    boost::property_tree::ptree binaries;
+    BOOST_FOREACH(const Binary& binary, entry.binaries) {
+      if (blob >= blobs.size()) {
+        return false;
+      }
+      boost::property_tree::ptree b;
+      b.put("key", binary.key);
+      b.put("offset", offset);
+      b.put("size", blobs[blob].size());
+      binaries.push_back(std::make_pair("", b));
+      offset += blobs[blob].size();
+      blob++;
+    }
+    item.put_child("binaries", binaries);
+    boost::property_tree::ptree rules;
+    BOOST_FOREACH(const std::string& identifier, entry.catalog) {
+      boost::property_tree::ptree rule;
+      rule.put_value(identifier);
+      rules.push_back(std::make_pair("", rule));
+    }
+    item.put_child("rules", rules);
+    rulesets.push_back(std::make_pair("", item));
+  }
+  boost::property_tree::ptree tree;
+  tree.put_child("rulesets", rulesets);
+
+  std::stringstream ss;
+  try {
+    boost::property_tree::json_parser::write_json(ss, tree, false);
+  } catch (const std::exception& e) {
+    return false;
+  }
+  const std::string manifest = ss.str();
+
+  Header header;
+  memcpy(header.magic, BundleMagic, sizeof(BundleMagic));
+  header.version = BundleVersion;
+  header.manifestSize = manifest.size();
+
+  /* written to a temp file and renamed, a reader never maps a partial bundle */
+  QSaveFile output(file.c_str());
+  if (!output.open(QIODevice::WriteOnly)) {
+    return false;
+  }
+  output.write((const char*)&header, sizeof(header));
+  output.write(manifest.c_str(), manifest.size());
+  for (size_t i = 0; i < blob; ++i) {
+    if (!blobs[i].empty()) {
+      output.write(&blobs[i][0], blobs[i].size());
+    }
+  }
+  return output.commit();
+}
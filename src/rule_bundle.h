@@ -0,0 +1,54 @@
+#ifndef __RULE_BUNDLE_H__
+#define __RULE_BUNDLE_H__
+
+/* a single file holding every compiled ruleset, so they can all be loaded with one open */
+/* the file starts with a json manifest describing each ruleset, followed by the compiled rules */
+/* the bundle is memory mapped for reading. compiled rules are read straight out of the mapping */
+
+#include <boost/shared_ptr.hpp>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+class QFile;
+
+class RuleBundle
+{
+public:
+
+  struct Binary
+  {
+    std::string key; /* rule cache key */
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  struct Entry
+  {
+    std::string file;
+    std::string name;
+    std::string hash;
+    std::vector<Binary> binaries; /* one per shard */
+    std::vector<std::string> catalog; /* rule identifiers */
+  };
+
+  ~RuleBundle();
+  RuleBundle(const std::string& file);
+
+  bool isValid() const {return m_data != 0;}
+  const std::vector<Entry>& entries() const {return m_entries;}
+  const uint8_t* data(const Binary& binary) const;
+
+  /* blobs are in the same order as the binaries of each entry */
+  static bool write(const std::string& file, const std::vector<Entry>& entries, const std::vector<std::vector<char> >& blobs);
+
+private:
+
+  boost::shared_ptr<QFile> m_file;
+  uint8_t* m_data;
+  uint64_t m_dataStart;
+  std::vector<Entry> m_entries;
+
+};
+
+#endif // __RULE_BUNDLE_H__
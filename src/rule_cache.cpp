@@ -0,0 +1,224 @@
+#include "rule_cache.h"
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/foreach.hpp>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QLockFile>
+#include <QtCore/QSaveFile>
+
+namespace {
+
+const int LockTimeout = 10000; /* ms to wait for another process to release the index */
+const int LockStaleTime = 30000; /* ms before a lock left by a crashed process is broken */
+
+bool olderThan(const std::pair<std::string, int64_t>& a, const std::pair<std::string, int64_t>& b)
+{
+  return a.second < b.second;
+}
+
+}
+
+RuleCache::~RuleCache()
+{
+}
+
+RuleCache::RuleCache(const std::string& directory, uint64_t budget) : m_directory(directory), m_budget(budget), m_tempCounter(0)
+{
+  QDir dir(m_directory.c_str());
+  if (!dir.exists()) {
+    dir.mkpath(".");
+  }
+}
+
+std::string RuleCache::directory() const
+{
+  return m_directory;
+}
+
+std::string RuleCache::lookup(const std::string& key)
+{
+  if (key.empty()) {
+    return std::string();
+  }
+
+  QLockFile lock(lockPath().c_str());
+  lock.setStaleLockTime(LockStaleTime);
+  if (!lock.tryLock(LockTimeout)) {
+    return std::string(); /* treat a busy cache as a miss, the caller will compile */
+  }
+
+  Index index = readIndex();
+  std::string file = entryPath(key);
+  QFileInfo info(file.c_str());
+  if (!info.exists()) {
+    if (index.erase(key)) {
+      writeIndex(index);
+    }
+    return std::string();
+  }
+
+  /* refresh the lru position. entries written by other tools are adopted here */
+  Entry& entry = index[key];
+  entry.size = info.size();
+  entry.lastUse = QDateTime::currentMSecsSinceEpoch();
+  writeIndex(index);
+  return file;
+}
+
+std::string RuleCache::reserve(const std::string& key)
+{
+  /* unique per process and per call so concurrent writers never share a temp file */
+  std::stringstream ss;
+  ss << key << ".tmp." << QCoreApplication::applicationPid() << "." << m_tempCounter++;
+  QDir dir(m_directory.c_str());
+  return dir.absoluteFilePath(ss.str().c_str()).toStdString();
+}
+
+bool RuleCache::commit(const std::string& key, const std::string& tempFile)
+{
+  QLockFile lock(lockPath().c_str());
+  lock.setStaleLockTime(LockStaleTime);
+  if (!lock.tryLock(LockTimeout)) {
+    discard(tempFile);
+    return false;
+  }
+
+  std::string file = entryPath(key);
+  if (QFileInfo(file.c_str()).exists()) {
+    /* another process published the same content first */
+    discard(tempFile);
+  } else if (!QFile::rename(tempFile.c_str(), file.c_str())) {
+    discard(tempFile);
+    return false;
+  }
+
+  Index index = readIndex();
+  Entry& entry = index[key];
+  entry.size = QFileInfo(file.c_str()).size();
+  entry.lastUse = QDateTime::currentMSecsSinceEpoch();
+  evict(index, key);
+  writeIndex(index);
+  return true;
+}
+
+void RuleCache::discard(const std::string& tempFile)
+{
+  QFile::remove(tempFile.c_str());
+}
+
+void RuleCache::remove(const std::string& key)
+{
+  if (key.empty()) {
+    return;
+  }
+
+  QLockFile lock(lockPath().c_str());
+  lock.setStaleLockTime(LockStaleTime);
+  if (!lock.tryLock(LockTimeout)) {
+    return;
+  }
+
+  Index index = readIndex();
+  QFile::remove(entryPath(key).c_str());
+  index.erase(key);
+  writeIndex(index);
+}
+
+RuleCache::Index RuleCache::readIndex() const
+{
+  /* caller must hold the lock */
+  Index index;
+  boost::property_tree::ptree tree;
+  try {
+    boost::property_tree::json_parser::read_json(indexPath(), tree);
+  } catch (const std::exception& e) {
+    return index; /* missing or corrupt index. entries are re-adopted on lookup */
+  }
+
+  BOOST_FOREACH(const boost::property_tree::ptree::value_type& item, tree.get_child("entries", boost::property_tree::ptree())) {
+    Entry entry;
+    entry.size = item.second.get<uint64_t>("size", 0);
+    entry.lastUse = item.second.get<int64_t>("used", 0);
+    index[item.first] = entry;
+  }
+  return index;
+}
+
+bool RuleCache::writeIndex(const Index& index) const
+{
+  /* caller must hold the lock */
+  boost::property_tree::ptree entries;
+  BOOST_FOREACH(const Index::value_type& item, index) {
+    boost::property_tree::ptree entry;
+    entry.put("size", item.second.size);
+    entry.put("used", item.second.lastUse);
+    entries.push_back(std::make_pair(item.first, entry));
+  }
+  boost::property_tree::ptree tree;
+  tree.put_child("entries", entries);
+
+  std::stringstream ss;
+  try {
+    boost::property_tree::json_parser::write_json(ss, tree);
+  } catch (const std::exception& e) {
+    return false;
+  }
+
+  /* written to a temp file and renamed so readers never see a partial index */
+  const std::string data = ss.str();
+  QSaveFile file(indexPath().c_str());
+  if (!file.open(QIODevice::WriteOnly)) {
+    return false;
+  }
+  file.write(data.c_str(), data.size());
+  return file.commit();
+}
+
+void RuleCache::evict(Index& index, const std::string& keep)
+{
+  uint64_t total = 0;
+  std::vector<std::pair<std::string, int64_t> > order;
+  BOOST_FOREACH(const Index::value_type& item, index) {
+    total += item.second.size;
+    if (item.first != keep) {
+      order.push_back(std::make_pair(item.first, item.second.lastUse));
+    }
+  }
+
+  /* least recently used first */
+  std::sort(order.begin(), order.end(), olderThan);
+
+  for (size_t i = 0; i < order.size() && total > m_budget; ++i) {
+    std::string file = entryPath(order[i].first);
+    if (QFileInfo(file.c_str()).exists() && !QFile::remove(file.c_str())) {
+      continue; /* still open somewhere, try again next time */
+    }
+    total -= index[order[i].first].size;
+    index.erase(order[i].first);
+  }
+}
+
+std::string RuleCache::entryPath(const std::string& key) const
+{
+  QDir dir(m_directory.c_str());
+  return dir.absoluteFilePath(key.c_str()).toStdString();
+}
+
+std::string RuleCache::indexPath() const
+{
+  QDir dir(m_directory.c_str());
+  return dir.absoluteFilePath("index.json").toStdString();
+}
+
+std::string RuleCache::lockPath() const
+{
+  QDir dir(m_directory.c_str());
+  return dir.absoluteFilePath("index.lock").toStdString();
+}
@@ -0,0 +1,54 @@
+#ifndef __RULE_CACHE_H__
+#define __RULE_CACHE_H__
+
+/* content addressed store for compiled rules */
+/* entries are named by the hash of their source and tracked in an index with sizes and last use times */
+/* the index is guarded by a lock file so that several processes can share one cache directory */
+
+#include <boost/shared_ptr.hpp>
+#include <string>
+#include <map>
+#include <stdint.h>
+
+class RuleCache
+{
+public:
+
+  typedef boost::shared_ptr<RuleCache> Ref;
+
+  ~RuleCache();
+  RuleCache(const std::string& directory, uint64_t budget);
+
+  std::string directory() const;
+
+  std::string lookup(const std::string& key); /* returns the path of a cached entry, or empty on a miss */
+  std::string reserve(const std::string& key); /* returns a private temp path to write a new entry into */
+  bool commit(const std::string& key, const std::string& tempFile); /* publish a written entry and evict */
+  void discard(const std::string& tempFile);
+  void remove(const std::string& key);
+
+private:
+
+  struct Entry
+  {
+    uint64_t size;
+    int64_t lastUse;
+  };
+
+  typedef std::map<std::string, Entry> Index;
+
+  Index readIndex() const;
+  bool writeIndex(const Index& index) const;
+  void evict(Index& index, const std::string& keep);
+
+  std::string entryPath(const std::string& key) const;
+  std::string indexPath() const;
+  std::string lockPath() const;
+
+  std::string m_directory;
+  uint64_t m_budget;
+  int m_tempCounter;
+
+};
+
+#endif // __RULE_CACHE_H__
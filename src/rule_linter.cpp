@@ -0,0 +1,380 @@
+#include "rule_linter.h"
+#include <boost/foreach.hpp>
+#include <algorithm>
+#include <sstream>
+#include <stdlib.h>
+#include <stdint.h>
+#include <ctype.h>
+
+namespace {
+
+const double Megabyte = 1024.0 * 1024.0;
+const size_t MaxAtomLength = 4; /* YR_MAX_ATOM_LENGTH */
+const double MaxStringMatches = 1000000; /* MAX_STRING_MATCHES, above this yara fails with ERROR_TOO_MANY_MATCHES */
+const double RegexScanLimit = 4096; /* RE_SCAN_LIMIT, bytes a regex or unbounded jump may examine per hit */
+const double ChainingThreshold = 200; /* STRING_CHAINING_THRESHOLD, longer jumps split a hex string into a chain */
+const double LargeFileSize = 100; /* MB, files this size are common enough to warn about */
+
+bool moreExpensive(const RuleLinter::Finding& a, const RuleLinter::Finding& b)
+{
+  return a.cost > b.cost;
+}
+
+bool hasModifier(const RuleParser::String& string, const std::string& modifier)
+{
+  return std::find(string.modifiers.begin(), string.modifiers.end(), modifier) != string.modifiers.end();
+}
+
+int hexValue(char c)
+{
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+void closeRun(std::vector<std::string>& runs, std::string& run)
+{
+  if (!run.empty()) {
+    runs.push_back(run);
+    run.clear();
+  }
+}
+
+}
+
+RuleLinter::RuleLinter(const std::string& source) : m_source(source)
+{
+  RuleParser parser(m_source);
+  BOOST_FOREACH(const RuleParser::Rule& rule, parser.rules()) {
+    BOOST_FOREACH(const RuleParser::String& string, rule.strings) {
+      lintString(rule, string);
+    }
+  }
+  std::stable_sort(m_findings.begin(), m_findings.end(), moreExpensive);
+}
+
+std::string RuleLinter::report(const std::string& file) const
+{
+  std::stringstream ss;
+  BOOST_FOREACH(const Finding& finding, m_findings) {
+    ss << file << "(" << finding.line << "): performance: rule " << finding.rule << ", string " << finding.string << ": "
+       << finding.message << " (about " << (uint64_t)finding.cost << " bytes verified per MB)" << std::endl;
+  }
+  return ss.str();
+}
+
+void RuleLinter::lintString(const RuleParser::Rule& rule, const RuleParser::String& string)
+{
+  bool nocase = hasModifier(string, "nocase");
+  const bool wide = hasModifier(string, "wide");
+
+  /* every form of the string gets its own atoms */
+  std::vector<Pattern> patterns;
+  if (string.type == RuleParser::StringText) {
+    if (!wide || hasModifier(string, "ascii")) {
+      patterns.push_back(parseText(string.value, false));
+    }
+    if (wide) {
+      patterns.push_back(parseText(string.value, true));
+    }
+  } else if (string.type == RuleParser::StringHex) {
+    patterns.push_back(parseHex(string.value));
+  } else {
+    const std::string flags = string.value.substr(string.value.rfind('/') + 1);
+    nocase |= flags.find('i') != std::string::npos;
+    patterns.push_back(parseRegex(string.value));
+  }
+  const double variants = hasModifier(string, "xor") ? 256 : 1;
+
+  double hits = 0; /* atom hits per MB */
+  double matches = 0; /* full matches per MB */
+  double span = 0;
+  double maxJump = 0;
+  bool unbounded = false;
+  size_t atomLength = MaxAtomLength;
+  bool atomCommon = false;
+  BOOST_FOREACH(const Pattern& pattern, patterns) {
+    /* yara picks the rarest window of up to four fixed bytes as the atom */
+    double best = Megabyte; /* no atom, every offset is verified */
+    size_t bestLength = 0;
+    bool bestCommon = false;
+    double match = Megabyte;
+    BOOST_FOREACH(const std::string& run, pattern.runs) {
+      for (size_t i = 0; i < run.size(); ++i) {
+        const size_t length = std::min(MaxAtomLength, run.size() - i);
+        double window = Megabyte;
+        bool common = true;
+        for (size_t j = i; j < i + length; ++j) {
+          window *= byteFrequency(run[j], nocase);
+          common &= isCommonByte(run[j]);
+        }
+        if (window < best) {
+          best = window;
+          bestLength = length;
+          bestCommon = common;
+        }
+        match *= byteFrequency(run[i], nocase);
+      }
+    }
+    hits += best * variants;
+    matches += std::min(match, best) * variants;
+    span = std::max(span, pattern.span);
+    maxJump = std::max(maxJump, pattern.maxJump);
+    unbounded |= pattern.unbounded;
+    if (bestLength < atomLength || (bestLength == atomLength && bestCommon)) {
+      atomLength = bestLength;
+      atomCommon = bestCommon;
+    }
+  }
+
+  const double cost = hits * std::max(span, 1.0);
+
+  if (atomLength == 0) {
+    addFinding(rule, string, "no fixed bytes to build an atom from, every offset is verified", cost);
+  } else if (atomLength <= 2) {
+    std::stringstream ss;
+    ss << "best atom is only " << atomLength << (atomLength == 1 ? " byte" : " bytes");
+    addFinding(rule, string, ss.str(), cost);
+  } else if (atomCommon) {
+    addFinding(rule, string, "atom is made of common bytes only (00, 20, 90, CC, FF)", cost);
+  }
+
+  if (string.type == RuleParser::StringHex) {
+    if (unbounded) {
+      addFinding(rule, string, "unbounded hex jump", cost);
+    } else if (maxJump > ChainingThreshold) {
+      std::stringstream ss;
+      ss << "hex jump of up to " << (uint64_t)maxJump << " bytes splits the string into a chain";
+      addFinding(rule, string, ss.str(), cost);
+    }
+  } else if (string.type == RuleParser::StringRegex && unbounded) {
+    std::stringstream ss;
+    ss << "unbounded regex quantifier, each atom hit may examine up to " << (uint64_t)RegexScanLimit << " bytes";
+    addFinding(rule, string, ss.str(), cost);
+  }
+
+  if (matches * LargeFileSize >= MaxStringMatches) {
+    std::stringstream ss;
+    ss << "likely to fail with ERROR_TOO_MANY_MATCHES on files over " << std::max<uint64_t>(1, (uint64_t)(MaxStringMatches / matches)) << " MB";
+    addFinding(rule, string, ss.str(), cost);
+  }
+}
+
+void RuleLinter::addFinding(const RuleParser::Rule& rule, const RuleParser::String& string, const std::string& message, double cost)
+{
+  Finding finding;
+  finding.rule = rule.identifier;
+  finding.string = string.identifier;
+  finding.line = 1 + std::count(m_source.begin(), m_source.begin() + std::min(string.begin, m_source.size()), '\n');
+  finding.message = message;
+  finding.cost = cost;
+  m_findings.push_back(finding);
+}
+
+RuleLinter::Pattern RuleLinter::parseText(const std::string& value, bool wide)
+{
+  std::string bytes;
+  for (size_t i = 0; i < value.size(); ++i) {
+    char c = value[i];
+    if (c == '\\' && i + 1 < value.size()) {
+      c = value[++i];
+      if (c == 'n') {
+        c = '\n';
+      } else if (c == 't') {
+        c = '\t';
+      } else if (c == 'x' && i + 2 < value.size() && hexValue(value[i + 1]) >= 0 && hexValue(value[i + 2]) >= 0) {
+        c = char(hexValue(value[i + 1]) * 16 + hexValue(value[i + 2]));
+        i += 2;
+      }
+    }
+    bytes += c;
+    if (wide) {
+      bytes += '\0';
+    }
+  }
+
+  Pattern pattern;
+  pattern.runs.push_back(bytes);
+  pattern.span = double(bytes.size());
+  pattern.maxJump = 0;
+  pattern.unbounded = false;
+  return pattern;
+}
+
+RuleLinter::Pattern RuleLinter::parseHex(const std::string& value)
+{
+  Pattern pattern;
+  pattern.span = 0;
+  pattern.maxJump = 0;
+  pattern.unbounded = false;
+
+  /* alternatives are counted as if they followed each other, which overestimates the span a little */
+  std::string run;
+  size_t i = 0;
+  while (i < value.size()) {
+    const char c = value[i];
+    if (hexValue(c) >= 0 || c == '?') {
+      if (i + 1 >= value.size()) {
+        break;
+      }
+      const int high = hexValue(c);
+      const int low = hexValue(value[i + 1]);
+      if (high >= 0 && low >= 0) {
+        run += char(high * 16 + low);
+      } else {
+        closeRun(pattern.runs, run); /* wildcard */
+      }
+      pattern.span += 1;
+      i += 2;
+    } else if (c == '[') {
+      size_t end = value.find(']', i);
+      if (end == std::string::npos) {
+        break;
+      }
+      const std::string range = value.substr(i + 1, end - i - 1);
+      const size_t dash = range.find('-');
+      const std::string upper = dash == std::string::npos ? range : range.substr(dash + 1);
+      if (upper.find_first_of("0123456789") == std::string::npos) {
+        pattern.unbounded = true;
+        pattern.span += RegexScanLimit;
+      } else {
+        const double jump = atof(upper.c_str());
+        pattern.maxJump = std::max(pattern.maxJump, jump);
+        pattern.span += jump;
+      }
+      closeRun(pattern.runs, run);
+      i = end + 1;
+    } else {
+      if (c == '(' || c == '|' || c == ')') {
+        closeRun(pattern.runs, run);
+      }
+      i++;
+    }
+  }
+  closeRun(pattern.runs, run);
+  return pattern;
+}
+
+RuleLinter::Pattern RuleLinter::parseRegex(const std::string& value)
+{
+  Pattern pattern;
+  pattern.span = 0;
+  pattern.maxJump = 0;
+  pattern.unbounded = false;
+
+  const size_t last = value.rfind('/');
+  const std::string regex = last > 0 ? value.substr(1, last - 1) : std::string();
+
+  /* collect literal runs, anything that is not a single known byte ends a run */
+  std::string run;
+  bool literal = false; /* the last item was appended to run */
+  size_t i = 0;
+  while (i < regex.size()) {
+    const char c = regex[i];
+    if (c == '\\' && i + 1 < regex.size()) {
+      const char e = regex[i + 1];
+      i += 2;
+      if (e == 'x' && i + 1 < regex.size() && hexValue(regex[i]) >= 0 && hexValue(regex[i + 1]) >= 0) {
+        run += char(hexValue(regex[i]) * 16 + hexValue(regex[i + 1]));
+        literal = true;
+        i += 2;
+      } else if (isalpha((unsigned char)e) && e != 'n' && e != 't' && e != 'r') {
+        closeRun(pattern.runs, run); /* class like \d or \w, or an anchor like \b */
+        literal = false;
+      } else {
+        run += e == 'n' ? '\n' : e == 't' ? '\t' : e == 'r' ? '\r' : e;
+        literal = true;
+      }
+      pattern.span += 1;
+    } else if (c == '[') {
+      size_t end = i + 1;
+      if (end < regex.size() && regex[end] == '^') end++;
+      if (end < regex.size() && regex[end] == ']') end++;
+      while (end < regex.size() && regex[end] != ']') {
+        end += regex[end] == '\\' ? 2 : 1;
+      }
+      closeRun(pattern.runs, run);
+      literal = false;
+      pattern.span += 1;
+      i = end + 1;
+    } else if (c == '*' || c == '+' || c == '?' || c == '{') {
+      /* quantifier on the previous item */
+      bool optional = c == '*' || c == '?';
+      size_t next = i + 1;
+      if (c == '{') {
+        size_t end = regex.find('}', i);
+        if (end == std::string::npos) {
+          end = regex.size();
+        }
+        const std::string range = regex.substr(i + 1, end - i - 1);
+        const size_t comma = range.find(',');
+        optional = atoi(range.c_str()) == 0;
+        if (comma != std::string::npos && comma + 1 == range.size()) {
+          pattern.unbounded = true;
+        } else {
+          pattern.span += atof(comma == std::string::npos ? range.c_str() : range.substr(comma + 1).c_str());
+        }
+        next = end + 1;
+      } else if (c != '?') {
+        pattern.unbounded = true;
+      }
+      if (optional && literal && !run.empty()) {
+        run.erase(run.size() - 1);
+      }
+      closeRun(pattern.runs, run);
+      literal = false;
+      if (next < regex.size() && regex[next] == '?') {
+        next++; /* lazy */
+      }
+      i = next;
+    } else if (c == '.' || c == '(' || c == ')' || c == '|' || c == '^' || c == '$') {
+      closeRun(pattern.runs, run);
+      literal = false;
+      pattern.span += c == '.' ? 1 : 0;
+      i++;
+    } else {
+      run += c;
+      literal = true;
+      pattern.span += 1;
+      i++;
+    }
+  }
+  closeRun(pattern.runs, run);
+
+  if (pattern.unbounded) {
+    pattern.span = RegexScanLimit;
+  }
+  return pattern;
+}
+
+double RuleLinter::byteFrequency(unsigned char byte, bool nocase)
+{
+  /* rough frequencies in executables and documents */
+  switch (byte) {
+  case 0x00:
+    return 0.15;
+  case 0xFF:
+    return 0.04;
+  case 0x20:
+    return 0.015;
+  case 0x90:
+  case 0xCC:
+    return 0.01;
+  }
+  if (isalpha(byte)) {
+    if (nocase) {
+      return 0.009; /* either case matches */
+    }
+    return islower(byte) ? 0.006 : 0.003;
+  }
+  if (isdigit(byte)) {
+    return 0.004;
+  }
+  return 0.002;
+}
+
+bool RuleLinter::isCommonByte(unsigned char byte)
+{
+  return byte == 0x00 || byte == 0x20 || byte == 0x90 || byte == 0xCC || byte == 0xFF;
+}
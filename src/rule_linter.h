@@ -0,0 +1,56 @@
+#ifndef __RULE_LINTER_H__
+#define __RULE_LINTER_H__
+
+/* finds strings that will make a rule slow to scan */
+/* costs are rough estimates of the bytes yara verifies per megabyte scanned, based on the atom it will pick */
+/* and the byte frequencies of typical executables. they are meant for ranking findings, not for exact timing */
+
+#include "rule_parser.h"
+#include <string>
+#include <vector>
+
+class RuleLinter
+{
+public:
+
+  RuleLinter(const std::string& source);
+
+  struct Finding
+  {
+    std::string rule;
+    std::string string;
+    size_t line;
+    std::string message;
+    double cost;
+  };
+
+  const std::vector<Finding>& findings() const {return m_findings;} /* most expensive first */
+
+  /* one compiler style line per finding */
+  std::string report(const std::string& file) const;
+
+private:
+
+  struct Pattern
+  {
+    std::vector<std::string> runs; /* sequences of fixed bytes, atoms are taken from these */
+    double span; /* bytes examined to verify one atom hit */
+    double maxJump; /* largest hex jump */
+    bool unbounded; /* unbounded hex jump or regex quantifier */
+  };
+
+  void lintString(const RuleParser::Rule& rule, const RuleParser::String& string);
+  void addFinding(const RuleParser::Rule& rule, const RuleParser::String& string, const std::string& message, double cost);
+
+  static Pattern parseText(const std::string& value, bool wide);
+  static Pattern parseHex(const std::string& value);
+  static Pattern parseRegex(const std::string& value);
+  static double byteFrequency(unsigned char byte, bool nocase);
+  static bool isCommonByte(unsigned char byte);
+
+  std::string m_source;
+  std::vector<Finding> m_findings;
+
+};
+
+#endif // __RULE_LINTER_H__
@@ -0,0 +1,373 @@
+#include "rule_parser.h"
+#include <boost/foreach.hpp>
+#include <algorithm>
+#include <map>
+#include <ctype.h>
+
+namespace {
+
+bool isWordChar(char c)
+{
+  return isalnum((unsigned char)c) || c == '_';
+}
+
+size_t findRoot(std::vector<size_t>& parent, size_t i)
+{
+  while (parent[i] != i) {
+    parent[i] = parent[parent[i]];
+    i = parent[i];
+  }
+  return i;
+}
+
+bool largerGroup(const std::pair<size_t, size_t>& a, const std::pair<size_t, size_t>& b)
+{
+  return a.second > b.second;
+}
+
+}
+
+RuleParser::RuleParser(const std::string& source) : m_source(source), m_pos(0), m_valid(true)
+{
+  parse();
+}
+
+std::vector<std::string> RuleParser::shard(size_t count) const
+{
+  std::vector<std::string> shards;
+
+  /* included files and global rules affect every rule in the file, so these can not be split */
+  bool hasGlobal = false;
+  BOOST_FOREACH(const Rule& rule, m_rules) {
+    hasGlobal |= rule.isGlobal;
+  }
+  if (!m_valid || hasGlobal || !m_includes.empty() || count < 2 || m_rules.size() < 2) {
+    shards.push_back(m_source);
+    return shards;
+  }
+
+  /* biggest groups first, each into the currently smallest shard */
+  std::vector<std::vector<size_t> > groups = groupRules();
+  std::vector<std::pair<size_t, size_t> > order;
+  for (size_t i = 0; i < groups.size(); ++i) {
+    size_t bytes = 0;
+    BOOST_FOREACH(size_t r, groups[i]) {
+      bytes += m_rules[r].end - m_rules[r].begin;
+    }
+    order.push_back(std::make_pair(i, bytes));
+  }
+  std::stable_sort(order.begin(), order.end(), largerGroup);
+
+  count = std::min(count, groups.size());
+  std::vector<size_t> shardBytes(count);
+  std::vector<std::vector<bool> > keep(count, std::vector<bool>(m_rules.size()));
+  for (size_t i = 0; i < order.size(); ++i) {
+    size_t target = std::min_element(shardBytes.begin(), shardBytes.end()) - shardBytes.begin();
+    shardBytes[target] += order[i].second;
+    BOOST_FOREACH(size_t r, groups[order[i].first]) {
+      keep[target][r] = true;
+    }
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    shards.push_back(keepRules(keep[i]));
+  }
+  return shards;
+}
+
+std::string RuleParser::subset(const std::vector<bool>& selected) const
+{
+  /* included rules can not be seen from here */
+  if (!m_valid || !m_includes.empty()) {
+    return m_source;
+  }
+
+  std::map<std::string, size_t> names;
+  for (size_t i = 0; i < m_rules.size(); ++i) {
+    names[m_rules[i].identifier] = i;
+  }
+
+  std::vector<bool> keep(m_rules.size());
+  std::vector<size_t> pending;
+  for (size_t i = 0; i < m_rules.size(); ++i) {
+    if ((i < selected.size() && selected[i]) || m_rules[i].isGlobal) {
+      keep[i] = true;
+      pending.push_back(i);
+    }
+  }
+
+  /* follow references so conditions still compile */
+  while (!pending.empty()) {
+    const size_t i = pending.back();
+    pending.pop_back();
+    BOOST_FOREACH(const std::string& reference, m_rules[i].references) {
+      std::map<std::string, size_t>::const_iterator j = names.find(reference);
+      if (j != names.end() && !keep[j->second]) {
+        keep[j->second] = true;
+        pending.push_back(j->second);
+      }
+    }
+  }
+  return keepRules(keep);
+}
+
+void RuleParser::parse()
+{
+  for (;;) {
+    Token token = nextToken(false);
+    if (token.type == TokenEnd) {
+      return;
+    }
+
+    if (token.type == TokenWord && (token.text == "import" || token.text == "include")) {
+      Token value = nextToken(false);
+      if (value.type != TokenString) {
+        m_valid = false;
+        return;
+      }
+      Statement statement;
+      statement.value = value.text;
+      statement.begin = token.begin;
+      statement.end = value.end;
+      if (token.text == "import") {
+        m_imports.push_back(statement);
+      } else {
+        m_includes.push_back(statement);
+      }
+      continue;
+    }
+
+    if (!parseRule(token)) {
+      m_valid = false;
+      return;
+    }
+  }
+}
+
+bool RuleParser::parseRule(Token token)
+{
+  Rule rule;
+  rule.isPrivate = false;
+  rule.isGlobal = false;
+  rule.begin = token.begin;
+
+  /* modifiers */
+  while (token.type == TokenWord && (token.text == "private" || token.text == "global")) {
+    rule.isPrivate |= token.text == "private";
+    rule.isGlobal |= token.text == "global";
+    token = nextToken(false);
+  }
+
+  if (token.type != TokenWord || token.text != "rule") {
+    return false;
+  }
+
+  token = nextToken(false);
+  if (token.type != TokenWord) {
+    return false;
+  }
+  rule.identifier = token.text;
+
+  /* optional tags */
+  token = nextToken(false);
+  if (token.type == TokenSymbol && token.text == ":") {
+    token = nextToken(false);
+    while (token.type == TokenWord) {
+      rule.tags.push_back(token.text);
+      token = nextToken(false);
+    }
+  }
+
+  if (token.type != TokenSymbol || token.text != "{") {
+    return false;
+  }
+
+  /* body. braces in hex strings are balanced so counting depth is enough */
+  int depth = 1;
+  int hexDepth = 0; /* depth of the hex string being read, if any */
+  size_t hexBegin = 0;
+  bool inCondition = false;
+  bool inStrings = false;
+  Token previous = token;
+  while (depth) {
+    const bool afterAssign = previous.type == TokenSymbol && previous.text == "=";
+    bool allowRegex = afterAssign;
+    allowRegex |= previous.type == TokenWord && previous.text == "matches";
+    token = nextToken(allowRegex);
+    if (token.type == TokenEnd) {
+      return false;
+    }
+    const bool defining = inStrings && !hexDepth && !rule.strings.empty();
+    if (token.type == TokenSymbol && token.text == "{") {
+      depth++;
+      if (defining && afterAssign) {
+        hexDepth = depth;
+        hexBegin = token.end;
+      }
+    } else if (token.type == TokenSymbol && token.text == "}") {
+      if (hexDepth == depth) {
+        rule.strings.back().type = StringHex;
+        rule.strings.back().value = m_source.substr(hexBegin, token.begin - hexBegin);
+        hexDepth = 0;
+      }
+      depth--;
+    } else if (token.type == TokenSymbol && token.text == ":" && previous.type == TokenWord &&
+               (previous.text == "meta" || previous.text == "strings" || previous.text == "condition")) {
+      inCondition = previous.text == "condition";
+      inStrings = previous.text == "strings";
+      if (!rule.strings.empty() && !rule.strings.back().modifiers.empty() && rule.strings.back().modifiers.back() == previous.text) {
+        rule.strings.back().modifiers.pop_back(); /* section keyword, not a modifier */
+      }
+    } else if (token.type == TokenWord && inCondition) {
+      rule.references.insert(token.text);
+    } else if (inStrings && !hexDepth && (token.type == TokenStringRef || (token.type == TokenSymbol && token.text == "$"))) {
+      String string;
+      string.identifier = token.text;
+      string.type = StringText;
+      string.begin = token.begin;
+      rule.strings.push_back(string);
+    } else if (defining && afterAssign && (token.type == TokenString || token.type == TokenRegex)) {
+      rule.strings.back().type = token.type == TokenString ? StringText : StringRegex;
+      rule.strings.back().value = token.text;
+    } else if (defining && token.type == TokenWord) {
+      rule.strings.back().modifiers.push_back(token.text);
+    }
+    previous = token;
+  }
+
+  rule.end = token.end;
+  m_rules.push_back(rule);
+  return true;
+}
+
+RuleParser::Token RuleParser::nextToken(bool allowRegex)
+{
+  skipSpace();
+
+  Token token;
+  token.begin = m_pos;
+  token.type = TokenEnd;
+
+  if (m_pos >= m_source.size()) {
+    token.end = m_pos;
+    return token;
+  }
+
+  const char c = m_source[m_pos];
+  if (c == '"') {
+    /* text string, keep the raw contents */
+    token.type = TokenString;
+    size_t i = m_pos + 1;
+    while (i < m_source.size() && m_source[i] != '"' && m_source[i] != '\n') {
+      i += m_source[i] == '\\' ? 2 : 1;
+    }
+    token.text = m_source.substr(m_pos + 1, std::min(i, m_source.size()) - m_pos - 1);
+    m_pos = std::min(i + 1, m_source.size());
+  } else if (c == '/' && allowRegex) {
+    token.type = TokenRegex;
+    size_t i = m_pos + 1;
+    while (i < m_source.size() && m_source[i] != '/' && m_source[i] != '\n') {
+      i += m_source[i] == '\\' ? 2 : 1;
+    }
+    i = std::min(i + 1, m_source.size());
+    while (i < m_source.size() && isalpha((unsigned char)m_source[i])) {
+      i++; /* modifiers */
+    }
+    token.text = m_source.substr(m_pos, i - m_pos);
+    m_pos = i;
+  } else if ((c == '$' || c == '#' || c == '@' || c == '!') && m_pos + 1 < m_source.size() && (isWordChar(m_source[m_pos + 1]) || m_source[m_pos + 1] == '*')) {
+    /* string identifiers are never rule references */
+    token.type = TokenStringRef;
+    size_t i = m_pos + 1;
+    while (i < m_source.size() && (isWordChar(m_source[i]) || m_source[i] == '*')) {
+      i++;
+    }
+    token.text = m_source.substr(m_pos, i - m_pos);
+    m_pos = i;
+  } else if (isWordChar(c)) {
+    token.type = TokenWord;
+    size_t i = m_pos;
+    while (i < m_source.size() && isWordChar(m_source[i])) {
+      i++;
+    }
+    token.text = m_source.substr(m_pos, i - m_pos);
+    m_pos = i;
+  } else {
+    token.type = TokenSymbol;
+    token.text = std::string(1, c);
+    m_pos++;
+  }
+
+  token.end = m_pos;
+  return token;
+}
+
+void RuleParser::skipSpace()
+{
+  while (m_pos < m_source.size()) {
+    if (isspace((unsigned char)m_source[m_pos])) {
+      m_pos++;
+    } else if (m_source.compare(m_pos, 2, "//") == 0) {
+      size_t eol = m_source.find('\n', m_pos);
+      m_pos = eol == std::string::npos ? m_source.size() : eol;
+    } else if (m_source.compare(m_pos, 2, "/*") == 0) {
+      size_t eoc = m_source.find("*/", m_pos + 2);
+      m_pos = eoc == std::string::npos ? m_source.size() : eoc + 2;
+    } else {
+      break;
+    }
+  }
+}
+
+std::vector<std::vector<size_t> > RuleParser::groupRules() const
+{
+  /* rules that reference each other must be compiled together */
+  std::map<std::string, size_t> names;
+  for (size_t i = 0; i < m_rules.size(); ++i) {
+    names[m_rules[i].identifier] = i;
+  }
+
+  std::vector<size_t> parent(m_rules.size());
+  for (size_t i = 0; i < parent.size(); ++i) {
+    parent[i] = i;
+  }
+
+  for (size_t i = 0; i < m_rules.size(); ++i) {
+    BOOST_FOREACH(const std::string& reference, m_rules[i].references) {
+      std::map<std::string, size_t>::const_iterator j = names.find(reference);
+      if (j != names.end()) {
+        parent[findRoot(parent, i)] = findRoot(parent, j->second);
+      }
+    }
+  }
+
+  std::map<size_t, size_t> groupIndex;
+  std::vector<std::vector<size_t> > groups;
+  for (size_t i = 0; i < m_rules.size(); ++i) {
+    size_t root = findRoot(parent, i);
+    if (groupIndex.find(root) == groupIndex.end()) {
+      groupIndex[root] = groups.size();
+      groups.push_back(std::vector<size_t>());
+    }
+    groups[groupIndex[root]].push_back(i);
+  }
+  return groups;
+}
+
+std::string RuleParser::keepRules(const std::vector<bool>& keep) const
+{
+  /* dropped rules are replaced by their newlines so compiler messages keep the original line numbers */
+  std::string output;
+  size_t pos = 0;
+  for (size_t i = 0; i < m_rules.size(); ++i) {
+    output.append(m_source, pos, m_rules[i].begin - pos);
+    if (keep[i]) {
+      output.append(m_source, m_rules[i].begin, m_rules[i].end - m_rules[i].begin);
+    } else {
+      output.append(std::count(m_source.begin() + m_rules[i].begin, m_source.begin() + m_rules[i].end, '\n'), '\n');
+    }
+    pos = m_rules[i].end;
+  }
+  output.append(m_source, pos, std::string::npos);
+  return output;
+}
@@ -0,0 +1,101 @@
+#ifndef __RULE_PARSER_H__
+#define __RULE_PARSER_H__
+
+/* a lightweight reader for YARA rule source */
+/* it only finds top level statements and rule boundaries, the real parsing is left to the YARA compiler */
+
+#include <string>
+#include <vector>
+#include <set>
+
+class RuleParser
+{
+public:
+
+  RuleParser(const std::string& source);
+
+  struct Statement
+  {
+    std::string value; /* module name or include path */
+    size_t begin;
+    size_t end;
+  };
+
+  enum StringType
+  {
+    StringText,
+    StringHex,
+    StringRegex
+  };
+
+  struct String
+  {
+    std::string identifier;
+    StringType type;
+    std::string value; /* raw text between the quotes, braces or slashes, regex flags included */
+    std::vector<std::string> modifiers;
+    size_t begin;
+  };
+
+  struct Rule
+  {
+    std::string identifier;
+    std::vector<std::string> tags;
+    std::set<std::string> references; /* every word used in the condition */
+    std::vector<String> strings;
+    bool isPrivate;
+    bool isGlobal;
+    size_t begin; /* byte span of the rule including modifiers */
+    size_t end;
+  };
+
+  bool isValid() const {return m_valid;}
+  const std::vector<Rule>& rules() const {return m_rules;}
+  const std::vector<Statement>& imports() const {return m_imports;}
+  const std::vector<Statement>& includes() const {return m_includes;}
+
+  /* split into at most count sources at rule boundaries, keeping dependent rules together */
+  std::vector<std::string> shard(size_t count) const;
+
+  /* keep only the selected rules, the rules they reference and global rules */
+  std::string subset(const std::vector<bool>& selected) const;
+
+private:
+
+  enum TokenType
+  {
+    TokenEnd,
+    TokenWord,
+    TokenString,
+    TokenRegex,
+    TokenStringRef,
+    TokenSymbol
+  };
+
+  struct Token
+  {
+    TokenType type;
+    std::string text;
+    size_t begin;
+    size_t end;
+  };
+
+  void parse();
+  bool parseRule(Token token);
+  Token nextToken(bool allowRegex);
+  void skipSpace();
+
+  std::vector<std::vector<size_t> > groupRules() const;
+  std::string keepRules(const std::vector<bool>& keep) const;
+
+  std::string m_source;
+  size_t m_pos;
+  bool m_valid;
+
+  std::vector<Rule> m_rules;
+  std::vector<Statement> m_imports;
+  std::vector<Statement> m_includes;
+
+};
+
+#endif // __RULE_PARSER_H__
@@ -0,0 +1,116 @@
+#include "rule_selector.h"
+#include <boost/foreach.hpp>
+#include <algorithm>
+#include <sstream>
+
+RuleSelector::RuleSelector()
+{
+}
+
+RuleSelector::RuleSelector(const std::string& expression)
+{
+  std::stringstream ss(expression);
+  std::string term;
+  while (ss >> term) {
+    const size_t colon = term.find(':');
+    const std::string kind = colon == std::string::npos ? std::string() : term.substr(0, colon);
+    const std::string value = term.substr(colon == std::string::npos ? 0 : colon + 1);
+    if (value.empty()) {
+      continue;
+    }
+    if (kind == "tag") {
+      m_tags.push_back(value);
+    } else if (kind == "ns" || kind == "namespace") {
+      m_namespaces.push_back(value);
+    } else if (kind.empty() || kind == "name") {
+      m_names.push_back(value);
+    } else {
+      m_names.push_back(term); /* unknown kind, matches nothing rather than everything */
+    }
+  }
+
+  /* order does not change the selection, so it must not change the cache key either */
+  std::sort(m_tags.begin(), m_tags.end());
+  m_tags.erase(std::unique(m_tags.begin(), m_tags.end()), m_tags.end());
+  std::sort(m_namespaces.begin(), m_namespaces.end());
+  m_namespaces.erase(std::unique(m_namespaces.begin(), m_namespaces.end()), m_namespaces.end());
+  std::sort(m_names.begin(), m_names.end());
+  m_names.erase(std::unique(m_names.begin(), m_names.end()), m_names.end());
+}
+
+bool RuleSelector::isEmpty() const
+{
+  return m_tags.empty() && m_namespaces.empty() && m_names.empty();
+}
+
+std::string RuleSelector::expression() const
+{
+  std::stringstream ss;
+  BOOST_FOREACH(const std::string& tag, m_tags) {
+    ss << "tag:" << tag << " ";
+  }
+  BOOST_FOREACH(const std::string& ns, m_namespaces) {
+    ss << "ns:" << ns << " ";
+  }
+  BOOST_FOREACH(const std::string& name, m_names) {
+    ss << "name:" << name << " ";
+  }
+  std::string expression = ss.str();
+  if (!expression.empty()) {
+    expression.erase(expression.size() - 1);
+  }
+  return expression;
+}
+
+bool RuleSelector::matches(const std::string& ns, const std::string& identifier, const std::vector<std::string>& tags) const
+{
+  if (!m_namespaces.empty() && !matchAny(m_namespaces, ns)) {
+    return false;
+  }
+  if (!m_names.empty() && !matchAny(m_names, identifier)) {
+    return false;
+  }
+  if (!m_tags.empty()) {
+    bool tagged = false;
+    BOOST_FOREACH(const std::string& tag, tags) {
+      tagged |= std::binary_search(m_tags.begin(), m_tags.end(), tag);
+    }
+    return tagged;
+  }
+  return true;
+}
+
+bool RuleSelector::matchAny(const std::vector<std::string>& patterns, const std::string& value)
+{
+  BOOST_FOREACH(const std::string& pattern, patterns) {
+    if (glob(pattern.c_str(), value.c_str())) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool RuleSelector::glob(const char* pattern, const char* value)
+{
+  /* iterative wildcard match, backtracking to the last star only */
+  const char* star = 0;
+  const char* resume = 0;
+  while (*value) {
+    if (*pattern == '*') {
+      star = pattern++;
+      resume = value;
+    } else if (*pattern == '?' || *pattern == *value) {
+      pattern++;
+      value++;
+    } else if (star) {
+      pattern = star + 1;
+      value = ++resume;
+    } else {
+      return false;
+    }
+  }
+  while (*pattern == '*') {
+    pattern++;
+  }
+  return !*pattern;
+}
@@ -0,0 +1,35 @@
+#ifndef __RULE_SELECTOR_H__
+#define __RULE_SELECTOR_H__
+
+/* picks a subset of rules by tag, namespace and name */
+/* the expression is a list of terms like "tag:ransomware tag:webshell name:Win_*", a bare word is a name */
+/* terms of the same kind are alternatives, different kinds must all match. names and namespaces may use * and ? */
+/* every ruleset is compiled into the default yara namespace, so a namespace term matches the ruleset name */
+
+#include <string>
+#include <vector>
+
+class RuleSelector
+{
+public:
+
+  RuleSelector();
+  RuleSelector(const std::string& expression);
+
+  bool isEmpty() const;
+  std::string expression() const; /* normalized, equal selections give equal expressions */
+
+  bool matches(const std::string& ns, const std::string& identifier, const std::vector<std::string>& tags) const;
+
+private:
+
+  static bool matchAny(const std::vector<std::string>& patterns, const std::string& value);
+  static bool glob(const char* pattern, const char* value);
+
+  std::vector<std::string> m_tags;
+  std::vector<std::string> m_namespaces;
+  std::vector<std::string> m_names;
+
+};
+
+#endif // __RULE_SELECTOR_H__
@@ -0,0 +1,56 @@
+#include "rule_watcher.h"
+#include <boost/make_shared.hpp>
+#include <boost/foreach.hpp>
+#include <QtCore/QFileInfo>
+#include <QtCore/QStringList>
+
+RuleWatcher::RuleWatcher()
+{
+  m_watcher = boost::make_shared<QFileSystemWatcher>();
+  connect(m_watcher.get(), SIGNAL(fileChanged(const QString&)), this, SLOT(handleFileChanged(const QString&)));
+  connect(m_watcher.get(), SIGNAL(directoryChanged(const QString&)), this, SLOT(handleFileChanged(const QString&)));
+
+  m_settleTimer = boost::make_shared<QTimer>();
+  m_settleTimer->setSingleShot(true);
+  connect(m_settleTimer.get(), SIGNAL(timeout()), this, SLOT(handleSettleTimer()));
+}
+
+void RuleWatcher::setFiles(const std::vector<std::string>& files)
+{
+  m_files = std::set<std::string>(files.begin(), files.end());
+
+  QStringList watched = m_watcher->files() + m_watcher->directories();
+  if (!watched.isEmpty()) {
+    m_watcher->removePaths(watched);
+  }
+
+  BOOST_FOREACH(const std::string& file, m_files) {
+    if (QFileInfo(file.c_str()).exists()) {
+      m_watcher->addPath(file.c_str());
+    }
+  }
+}
+
+void RuleWatcher::handleFileChanged(const QString& file)
+{
+  m_changed.insert(file.toStdString());
+  m_settleTimer->start(500);
+}
+
+void RuleWatcher::handleSettleTimer()
+{
+  std::set<std::string> changed;
+  std::swap(changed, m_changed);
+
+  BOOST_FOREACH(const std::string& file, changed) {
+    if (m_files.find(file) == m_files.end()) {
+      continue; /* removed from the watch list while settling */
+    }
+    /* editors often save by replacing the file, which drops it from the watcher */
+    const QStringList watched = m_watcher->files() + m_watcher->directories();
+    if (!watched.contains(file.c_str()) && QFileInfo(file.c_str()).exists()) {
+      m_watcher->addPath(file.c_str());
+    }
+    onFileChanged(file);
+  }
+}
@@ -0,0 +1,44 @@
+#ifndef __RULE_WATCHER_H__
+#define __RULE_WATCHER_H__
+
+/* watches rule files on disk and reports when they have been modified */
+/* changes are collected for a short time so an editor saving in several steps produces one event */
+
+#include <boost/shared_ptr.hpp>
+#include <boost/signals2.hpp>
+#include <QtCore/QObject>
+#include <QtCore/QTimer>
+#include <QtCore/QFileSystemWatcher>
+#include <vector>
+#include <set>
+#include <string>
+
+class RuleWatcher : public QObject
+{
+  Q_OBJECT
+
+public:
+
+  typedef boost::shared_ptr<RuleWatcher> Ref;
+
+  RuleWatcher();
+
+  boost::signals2::signal<void (const std::string& file)> onFileChanged;
+
+  void setFiles(const std::vector<std::string>& files);
+
+private slots:
+
+  void handleFileChanged(const QString& file);
+  void handleSettleTimer();
+
+private:
+
+  boost::shared_ptr<QFileSystemWatcher> m_watcher;
+  boost::shared_ptr<QTimer> m_settleTimer;
+  std::set<std::string> m_files;
+  std::set<std::string> m_changed;
+
+};
+
+#endif // __RULE_WATCHER_H__
@@ -76,6 +76,23 @@ void RuleWindow::setRules(const std::vector<RulesetView::Ref>& rules)
   m_ui.buttonBox->button(QDialogButtonBox::Apply)->setEnabled(false);
 }
 
+void RuleWindow::updateCompileState(const std::vector<RulesetView::Ref>& rules)
+{
+  /* refresh the compiled column only, so unsaved edits in the table survive */
+  for (size_t i = 0; i < m_rules.size(); ++i) {
+    BOOST_FOREACH(RulesetView::Ref rule, rules) {
+      if (rule->file() != m_rules[i]->file()) {
+        continue;
+      }
+      QLabel* itemCompiled = qobject_cast<QLabel*>(m_ui.table->cellWidget(int(i), 2));
+      if (itemCompiled) {
+        itemCompiled->setPixmap(rule->isCompiled() ? m_iconYes : m_iconNo);
+      }
+      break;
+    }
+  }
+}
+
 void RuleWindow::handleButtonClicked(QAbstractButton* button)
 {
   QDialogButtonBox::StandardButton choice = m_ui.buttonBox->standardButton(button);
@@ -224,7 +241,7 @@ void RuleWindow::dropEvent(QDropEvent* event)
   for (int i = 0; i < urls.size(); ++i) {
     QFileInfo fileInfo(urls[i].toLocalFile());
     QString file = QDir::toNativeSeparators(fileInfo.absoluteFilePath());
-    if (fileInfo.suffix() == "yar" || fileInfo.suffix() == "yara") {
+    if (fileInfo.isDir() || fileInfo.suffix() == "yar" || fileInfo.suffix() == "yara" || fileInfo.suffix() == "yarc") {
       bool duplicate = false;
       BOOST_FOREACH(RulesetView::Ref rule, m_rules) {
         if (rule->file() == file.toStdString()) {
@@ -20,6 +20,7 @@ public:
   boost::signals2::signal<void (RulesetView::Ref view)> onCompileRule;
 
   void setRules(const std::vector<RulesetView::Ref>& rules);
+  void updateCompileState(const std::vector<RulesetView::Ref>& rules);
 
 private slots:
 
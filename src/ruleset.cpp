@@ -1,5 +1,7 @@
 #include "ruleset.h"
 #include <boost/make_shared.hpp>
+#include <boost/foreach.hpp>
+#include <QtCore/QFileInfo>
 
 Ruleset::~Ruleset()
 {
@@ -10,10 +12,24 @@ Ruleset::Ruleset(const boost::property_tree::ptree& properties)
   m_file = properties.get<std::string>("file", "");
   m_name = properties.get<std::string>("name", "");
   m_hash = properties.get<std::string>("hash", "");
+  m_precompiled = properties.get<bool>("precompiled", isPrecompiledFile(m_file));
+  m_directory = properties.get<bool>("directory", QFileInfo(m_file.c_str()).isDir());
+  m_shardCount = properties.get<int>("shards", 1);
+  BOOST_FOREACH(const boost::property_tree::ptree::value_type& item, properties.get_child("parts", boost::property_tree::ptree())) {
+    m_partKeys.push_back(item.second.get_value<std::string>());
+  }
+  BOOST_FOREACH(const boost::property_tree::ptree::value_type& item, properties.get_child("dependencies", boost::property_tree::ptree())) {
+    m_dependencies.push_back(item.second.get_value<std::string>());
+  }
+}
+
+Ruleset::Ruleset(const std::string& file) : m_file(file), m_precompiled(isPrecompiledFile(file)), m_directory(QFileInfo(file.c_str()).isDir()), m_shardCount(1)
+{
 }
 
-Ruleset::Ruleset(const std::string& file) : m_file(file)
+bool Ruleset::isPrecompiledFile(const std::string& file)
 {
+  return QFileInfo(file.c_str()).suffix() == "yarc";
 }
 
 std::string Ruleset::file() const
@@ -21,6 +37,16 @@ std::string Ruleset::file() const
   return m_file;
 }
 
+bool Ruleset::isPrecompiled() const
+{
+  return m_precompiled;
+}
+
+bool Ruleset::isDirectory() const
+{
+  return m_directory;
+}
+
 std::string Ruleset::name() const
 {
   return m_name;
@@ -41,6 +67,46 @@ void Ruleset::setHash(const std::string& hash)
   m_hash = hash;
 }
 
+int Ruleset::shardCount() const
+{
+  return m_shardCount;
+}
+
+void Ruleset::setShardCount(int shardCount)
+{
+  m_shardCount = shardCount;
+}
+
+std::vector<std::string> Ruleset::partKeys() const
+{
+  return m_partKeys;
+}
+
+void Ruleset::setPartKeys(const std::vector<std::string>& partKeys)
+{
+  m_partKeys = partKeys;
+}
+
+std::vector<std::string> Ruleset::dependencies() const
+{
+  return m_dependencies;
+}
+
+void Ruleset::setDependencies(const std::vector<std::string>& dependencies)
+{
+  m_dependencies = dependencies;
+}
+
+std::vector<std::string> Ruleset::catalog() const
+{
+  return m_catalog;
+}
+
+void Ruleset::setCatalog(const std::vector<std::string>& catalog)
+{
+  m_catalog = catalog;
+}
+
 std::string Ruleset::compilerMessages() const
 {
   return m_compilerMessages;
@@ -66,5 +132,32 @@ boost::property_tree::ptree Ruleset::serialize() const
   if (!m_hash.empty()) {
     properties.put("hash", m_hash);
   }
+  if (m_precompiled) {
+    properties.put("precompiled", true);
+  }
+  if (m_directory) {
+    properties.put("directory", true);
+  }
+  if (m_shardCount > 1) {
+    properties.put("shards", m_shardCount);
+  }
+  if (!m_partKeys.empty()) {
+    boost::property_tree::ptree parts;
+    BOOST_FOREACH(const std::string& key, m_partKeys) {
+      boost::property_tree::ptree item;
+      item.put_value(key);
+      parts.push_back(std::make_pair("", item));
+    }
+    properties.put_child("parts", parts);
+  }
+  if (!m_dependencies.empty()) {
+    boost::property_tree::ptree dependencies;
+    BOOST_FOREACH(const std::string& dependency, m_dependencies) {
+      boost::property_tree::ptree item;
+      item.put_value(dependency);
+      dependencies.push_back(std::make_pair("", item));
+    }
+    properties.put_child("dependencies", dependencies);
+  }
   return properties;
 }
@@ -3,6 +3,7 @@
 
 #include "ruleset_view.h"
 #include <string>
+#include <vector>
 #include <boost/shared_ptr.hpp>
 #include <boost/property_tree/ptree.hpp>
 
@@ -16,14 +17,31 @@ public:
   Ruleset(const boost::property_tree::ptree& properties);
   Ruleset(const std::string& file);
 
+  static bool isPrecompiledFile(const std::string& file);
+
   std::string file() const;
 
+  bool isPrecompiled() const;
+  bool isDirectory() const;
+
   std::string name() const;
   void setName(const std::string& name);
 
   std::string hash() const;
   void setHash(const std::string& hash);
 
+  int shardCount() const;
+  void setShardCount(int shardCount);
+
+  std::vector<std::string> partKeys() const;
+  void setPartKeys(const std::vector<std::string>& partKeys);
+
+  std::vector<std::string> dependencies() const;
+  void setDependencies(const std::vector<std::string>& dependencies);
+
+  std::vector<std::string> catalog() const;
+  void setCatalog(const std::vector<std::string>& catalog);
+
   std::string compilerMessages() const;
   void setCompilerMessages(const std::string& compilerMessages);
 
@@ -35,7 +53,13 @@ private:
   std::string m_file;
   std::string m_name;
   std::string m_hash;
+  bool m_precompiled; /* a compiled binary built elsewhere, loaded as is */
+  bool m_directory; /* every rule file below a directory, compiled in parts */
+  std::vector<std::string> m_partKeys; /* cache keys of the directory parts */
+  int m_shardCount; /* number of compiled binaries the cached rules were split into */
+  std::vector<std::string> m_dependencies; /* every file pulled in through include, directly or not */
   std::string m_compilerMessages;
+  std::vector<std::string> m_catalog; /* identifiers of the compiled rules */
 
 };
 
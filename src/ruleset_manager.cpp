@@ -1,18 +1,32 @@
 #include "ruleset_manager.h"
 #include <boost/make_shared.hpp>
 #include <boost/foreach.hpp>
-#include <QtCore/QCoreApplication>
+#include <algorithm>
+#include <sstream>
+#include <set>
 #include <QtCore/QDir>
 #include <QtCore/QFileInfo>
+#include <QtCore/QCryptographicHash>
 
 RulesetManager::~RulesetManager()
 {
 }
 
-RulesetManager::RulesetManager(boost::asio::io_service& io, boost::shared_ptr<Settings> settings) : m_io(io), m_settings(settings)
+RulesetManager::RulesetManager(boost::asio::io_service& io, boost::shared_ptr<Settings> settings) : m_io(io), m_settings(settings), m_forceCompile(false), m_scanAborted(false), m_busy(false), m_precompiling(false), m_bundleDirty(false), m_pending(0)
 {
   m_scanner = boost::make_shared<Scanner>(boost::ref(io));
+
+  m_prefetcher = boost::make_shared<TargetPrefetcher>();
+  m_cache = boost::make_shared<RuleCache>(m_settings->getCacheDirectory(), m_settings->getCacheBudget());
   m_rules = m_settings->getRules();
+
+  /* every compiled ruleset is loaded up front from one file */
+  m_scanner->bundleLoad(bundleFile(), boost::bind(&RulesetManager::handleBundleLoad, this, _1));
+
+  /* recompile rules in the background as soon as they are saved */
+  m_watcher = boost::make_shared<RuleWatcher>();
+  m_watcher->onFileChanged.connect(boost::bind(&RulesetManager::handleRuleFileChanged, this, _1));
+  watchRules();
 }
 
 void RulesetManager::scan(const std::string& target, RulesetView::Ref view)
@@ -26,34 +40,44 @@ void RulesetManager::scan(const std::string& target, RulesetView::Ref view)
 void RulesetManager::scan(const std::vector<std::string>& targets, RulesetView::Ref view)
 {
   /* multiple target scan */
-  m_queueTargets = std::list<std::string>(targets.begin(), targets.end());
-
-  m_activeRule = viewToRule(view);
-  m_queueRules = ruleToQueue(m_activeRule, QueueAllRules); /* reload the queue for compiling */
+  scan(targets, view, RuleSelector());
+}
 
-  m_forceCompile = false;
-  m_scanAborted = false;
-  m_binaries.clear();
-  compileNextRule();
+void RulesetManager::scan(const std::vector<std::string>& targets, RulesetView::Ref view, const RuleSelector& selector)
+{
+  /* scan with only the selected rules of each ruleset */
+  start(std::list<std::string>(targets.begin(), targets.end()), viewToRule(view), selector, false);
 }
 
 void RulesetManager::scanAbort()
 {
+  m_prefetcher->abort();
+
+  /* waiting scans never start but are still reported, waiting compiles run as requested */
+  std::list<Request>::iterator request = m_deferred.begin();
+  while (request != m_deferred.end()) {
+    if (!request->targets.empty()) {
+      request = m_deferred.erase(request);
+      onScanComplete(std::string());
+    } else {
+      ++request;
+    }
+  }
+  if (m_busy && m_precompiling) {
+    return; /* only a background compile is running */
+  }
+
   m_scanAborted = true;
   m_scanner->scanStop();
+  BOOST_FOREACH(boost::shared_ptr<Scanner> worker, m_workers) {
+    worker->scanStop();
+  }
 }
 
 void RulesetManager::compile(RulesetView::Ref view)
 {
   /* force compile a rule, and don't scan afterwards */
-  m_queueTargets.clear();
-
-  m_activeRule = viewToRule(view);
-  m_queueRules = ruleToQueue(m_activeRule, QueueAllRules);
-
-  m_forceCompile = true;
-  m_binaries.clear();
-  compileNextRule();
+  start(std::list<std::string>(), viewToRule(view), RuleSelector(), true);
 }
 
 std::vector<RulesetView::Ref> RulesetManager::getRules() const
@@ -70,6 +94,7 @@ Ruleset::Ref RulesetManager::createRule(const std::string& file)
 {
   Ruleset::Ref ruleset = boost::make_shared<Ruleset>(file);
   m_rules.push_back(ruleset);
+  watchRules();
   return ruleset;
 }
 
@@ -85,9 +110,97 @@ void RulesetManager::updateRules(const std::vector<RulesetView::Ref>& rules)
   }
   m_rules = newRules;
   m_settings->setRules(m_rules);
+  watchRules();
   onRulesUpdated();
 }
 
+void RulesetManager::start(const std::list<std::string>& targets, Ruleset::Ref rule, const RuleSelector& selector, bool forceCompile)
+{
+  /* the target I/O ramps up while rules are hashed, loaded or compiled */
+  if (!targets.empty()) {
+    m_prefetcher->prefetch(targets);
+  }
+
+  Request request;
+  request.targets = targets;
+  request.rule = rule;
+  request.selector = selector;
+  request.forceCompile = forceCompile;
+
+  if (m_busy || !m_deferred.empty()) {
+    /* another operation is running, the scanner is ours once it and the requests before this one finish */
+    m_deferred.push_back(request);
+    return;
+  }
+  begin(request);
+}
+
+void RulesetManager::begin(const Request& request)
+{
+  m_busy = true;
+  m_precompiling = false;
+  m_queueTargets = request.targets;
+
+  m_activeRule = request.rule;
+  m_queueRules = ruleToQueue(m_activeRule, QueueAllRules); /* reload the queue for compiling */
+
+  m_selector = request.selector;
+  m_selectionKeys.clear(); /* derived binaries this operation does not use are destroyed when it ends */
+  m_queueSelect.clear();
+
+  m_forceCompile = request.forceCompile;
+  m_scanAborted = false;
+  m_binaries.clear();
+  compileNextRule();
+}
+
+void RulesetManager::precompileNext()
+{
+  if (m_busy || !m_deferred.empty() || m_queuePrecompile.empty()) {
+    return;
+  }
+
+  /* same as a compile without targets, but only rebuilds rules that changed */
+  m_busy = true;
+  m_precompiling = true;
+  m_queueTargets.clear();
+
+  m_activeRule = m_queuePrecompile.front();
+  m_queuePrecompile.pop_front();
+  m_queueRules = ruleToQueue(m_activeRule, QueueAllRules);
+
+  m_forceCompile = false;
+  m_scanAborted = false;
+  m_binaries.clear();
+  compileNextRule();
+}
+
+void RulesetManager::watchRules()
+{
+  std::vector<std::string> files;
+  BOOST_FOREACH(Ruleset::Ref ruleset, m_rules) {
+    files.push_back(ruleset->file());
+    std::vector<std::string> dependencies = ruleset->dependencies();
+    files.insert(files.end(), dependencies.begin(), dependencies.end());
+  }
+  m_watcher->setFiles(files);
+}
+
+void RulesetManager::handleRuleFileChanged(const std::string& file)
+{
+  /* only the rules that include the changed file, directly or not, are rebuilt */
+  BOOST_FOREACH(Ruleset::Ref ruleset, m_rules) {
+    std::vector<std::string> dependencies = ruleset->dependencies();
+    if (ruleset->file() != file && std::find(dependencies.begin(), dependencies.end(), file) == dependencies.end()) {
+      continue;
+    }
+    if (std::find(m_queuePrecompile.begin(), m_queuePrecompile.end(), ruleset) == m_queuePrecompile.end()) {
+      m_queuePrecompile.push_back(ruleset);
+    }
+  }
+  precompileNext();
+}
+
 void RulesetManager::handleRuleCompile(Scanner::CompileResult::Ref compileResult)
 {
   Ruleset::Ref ruleset = m_queueRules.front();
@@ -103,10 +216,13 @@ void RulesetManager::handleRuleCompile(Scanner::CompileResult::Ref compileResult
     return;
   }
 
-  m_binaries[ruleset->file()] = compileResult->rules;
+  m_binaries[ruleset->file()] = std::vector<YR_RULES*>(1, compileResult->rules);
+  ruleset->setCatalog(compileResult->catalog);
+  adoptBinary(ruleset->hash(), compileResult->rules, compileResult->catalog);
 
-  /* write the compiled rules to the cache */
-  m_scanner->rulesSave(compileResult->rules, compiledRuleCache(ruleset->hash()), boost::bind(&RulesetManager::handleRuleSave, this, _1));
+  /* write the compiled rules to a temp file, it is published to the cache once complete */
+  std::string tempFile = m_cache->reserve(ruleset->hash());
+  m_scanner->rulesSave(compileResult->rules, tempFile, boost::bind(&RulesetManager::handleRuleSave, this, _1, ruleset->hash(), tempFile));
 }
 
 void RulesetManager::handleScanResult(ScannerRule::Ref rule)
@@ -118,6 +234,10 @@ void RulesetManager::handleScanResult(ScannerRule::Ref rule)
 
 void RulesetManager::handleScanComplete(const std::string& error)
 {
+  if (--m_pending) {
+    return; /* other shards of this rule are still scanning */
+  }
+
   /* move onto the next rule. if there are no more rules, move on to the next target */
   m_queueRules.pop_front();
   if (m_queueRules.empty()) {
@@ -127,20 +247,91 @@ void RulesetManager::handleScanComplete(const std::string& error)
   scanWithCompiledRules();
 }
 
-void RulesetManager::handleRuleHash(const std::string& hash)
+void RulesetManager::handleRuleHash(Scanner::HashResult::Ref hashResult)
 {
   Ruleset::Ref ruleset = m_queueRules.front();
-  if (ruleset->hash() != hash || m_forceCompile) {
-    /* rule file has changed. will have to compile */
-    std::string ruleCacheFile = compiledRuleCache(ruleset->hash());
-    if (!ruleCacheFile.empty()) { /* remove old cache file */
-      QFile::remove(ruleCacheFile.c_str());
+  const std::string& hash = hashResult->hash;
+
+  /* the include graph may have changed with the source, keep watching every file the rules depend on */
+  if (!hash.empty() && ruleset->dependencies() != hashResult->dependencies) {
+    ruleset->setDependencies(hashResult->dependencies);
+    watchRules();
+  }
+  const size_t shardCount = ruleset->shardCount();
+  if (shardCount > 1) {
+    startWorkers(); /* shards built by an earlier run load and scan on the workers */
+  }
+  const bool haveWorkers = shardCount == 1 || shardCount <= m_workers.size(); /* one worker per shard */
+
+  if (ruleset->hash() == hash && !m_forceCompile && haveWorkers) {
+    /* already loaded by an earlier operation or from the bundle */
+    std::vector<YR_RULES*> resident;
+    for (size_t i = 0; i < shardCount; ++i) {
+      std::map<std::string, YR_RULES*>::iterator binary = m_resident.find(shardKey(hash, i, shardCount));
+      if (binary == m_resident.end()) {
+        break;
+      }
+      resident.push_back(binary->second);
     }
+    if (resident.size() == shardCount) {
+      if (!m_precompiling) {
+        m_binaries[ruleset->file()] = resident;
+      }
+      m_queueRules.pop_front();
+      compileNextRule();
+      return;
+    }
+  }
+
+  if (ruleset->isDirectory()) {
+    buildDirectory(ruleset, hashResult);
+    return;
+  }
+
+  if (ruleset->isPrecompiled()) {
+    /* compiled elsewhere, the file itself is the binary. yara checks the format version */
     ruleset->setHash(hash);
-    m_scanner->rulesCompile(ruleset->file(), "", boost::bind(&RulesetManager::handleRuleCompile, this, _1));
-  } else {
+    ruleset->setShardCount(1);
+    m_scanner->rulesLoad(ruleset->file(), boost::bind(&RulesetManager::handlePrecompiledLoad, this, _1));
+    return;
+  }
+
+  /* every shard must still be cached */
+  std::vector<std::string> ruleCacheFiles;
+  if (ruleset->hash() == hash && !m_forceCompile && haveWorkers) {
+    for (size_t i = 0; i < shardCount; ++i) {
+      std::string ruleCacheFile = m_cache->lookup(shardKey(hash, i, shardCount));
+      if (ruleCacheFile.empty()) {
+        ruleCacheFiles.clear();
+        break;
+      }
+      ruleCacheFiles.push_back(ruleCacheFile);
+    }
+  }
+
+  if (m_precompiling && !ruleCacheFiles.empty()) {
+    /* unchanged and already cached, nothing to warm up */
+    m_queueRules.pop_front();
+    compileNextRule();
+    return;
+  }
+
+  if (ruleCacheFiles.empty()) {
+    /* rule file has changed or was evicted. will have to compile */
+    /* old entries are left for the lru, another instance may still be using them */
+    ruleset->setHash(hash);
+    compileRule(ruleset);
+  } else if (ruleCacheFiles.size() == 1) {
     /* try to load from the cache */
-    m_scanner->rulesLoad(compiledRuleCache(hash), boost::bind(&RulesetManager::handleRuleLoad, this, _1));
+    m_scanner->rulesLoad(ruleCacheFiles[0], boost::bind(&RulesetManager::handleRuleLoad, this, _1));
+  } else {
+    /* load all shards from the cache in parallel */
+    m_shardBinaries = std::vector<YR_RULES*>(shardCount);
+    m_shardCatalogs = std::vector<std::vector<std::string> >(shardCount);
+    m_pending = shardCount;
+    for (size_t i = 0; i < shardCount; ++i) {
+      m_workers[i]->rulesLoad(ruleCacheFiles[i], boost::bind(&RulesetManager::handleShardLoad, this, _1, i));
+    }
   }
 }
 
@@ -149,22 +340,455 @@ void RulesetManager::handleRuleLoad(Scanner::LoadResult::Ref loadResult)
   Ruleset::Ref ruleset = m_queueRules.front();
   if (!loadResult->error.empty()) {
     /* failed to load the rules, will have to compile anyway */
-    m_scanner->rulesCompile(ruleset->file(), "", boost::bind(&RulesetManager::handleRuleCompile, this, _1));
+    m_cache->remove(ruleset->hash());
+    compileRule(ruleset);
   } else {
     /* loaded from the cache */
-    m_binaries[ruleset->file()] = loadResult->rules;
+    m_binaries[ruleset->file()] = std::vector<YR_RULES*>(1, loadResult->rules);
+    ruleset->setCatalog(loadResult->catalog);
+    adoptBinary(ruleset->hash(), loadResult->rules, loadResult->catalog);
     m_queueRules.pop_front();
     compileNextRule();
   }
 }
 
-void RulesetManager::handleRuleSave(const std::string& error)
+void RulesetManager::handlePrecompiledLoad(Scanner::LoadResult::Ref loadResult)
 {
-  /* cache updated */
+  Ruleset::Ref ruleset = m_queueRules.front();
+  if (!loadResult->error.empty()) {
+    /* reported like a compile error, there is no source to fall back to */
+    ruleset->setCompilerMessages("Failed to load compiled rules: " + loadResult->error);
+    ruleset->setHash(std::string());
+  } else {
+    ruleset->setCompilerMessages(std::string());
+    m_binaries[ruleset->file()] = std::vector<YR_RULES*>(1, loadResult->rules);
+    ruleset->setCatalog(loadResult->catalog);
+    adoptBinary(ruleset->hash(), loadResult->rules, loadResult->catalog);
+  }
   m_queueRules.pop_front();
   compileNextRule();
 }
 
+void RulesetManager::handleRuleSave(const std::string& error, const std::string& key, const std::string& tempFile)
+{
+  if (error.empty()) {
+    m_cache->commit(key, tempFile); /* cache updated */
+  } else {
+    m_cache->discard(tempFile);
+  }
+  m_queueRules.pop_front();
+  compileNextRule();
+}
+
+void RulesetManager::handleRuleSplit(Scanner::SplitResult::Ref splitResult)
+{
+  Ruleset::Ref ruleset = m_queueRules.front();
+
+  if (splitResult->shards.size() < 2) {
+    /* the file could not be split safely, compile it whole */
+    ruleset->setShardCount(1);
+    m_scanner->rulesCompile(ruleset->file(), "", boost::bind(&RulesetManager::handleRuleCompile, this, _1));
+    return;
+  }
+
+  const size_t shardCount = splitResult->shards.size();
+  ruleset->setShardCount(int(shardCount));
+  m_shardBinaries = std::vector<YR_RULES*>(shardCount);
+  m_shardMessages = std::vector<std::string>(shardCount);
+  m_shardCatalogs = std::vector<std::vector<std::string> >(shardCount);
+  m_pending = shardCount;
+  for (size_t i = 0; i < shardCount; ++i) {
+    m_workers[i]->rulesCompileSource(splitResult->shards[i], ruleset->file(), "", boost::bind(&RulesetManager::handleShardCompile, this, _1, i));
+  }
+}
+
+void RulesetManager::handleShardCompile(Scanner::CompileResult::Ref compileResult, size_t index)
+{
+  m_shardBinaries[index] = compileResult->rules;
+  m_shardMessages[index] = compileResult->compilerMessages;
+  m_shardCatalogs[index] = compileResult->catalog;
+  if (--m_pending) {
+    return; /* wait for the other shards */
+  }
+
+  Ruleset::Ref ruleset = m_queueRules.front();
+
+  if (std::find(m_shardBinaries.begin(), m_shardBinaries.end(), (YR_RULES*)0) != m_shardBinaries.end()) {
+    /* compile the whole file so the messages are exactly what the user would see without sharding */
+    discardShards();
+    ruleset->setShardCount(1);
+    m_scanner->rulesCompile(ruleset->file(), "", boost::bind(&RulesetManager::handleRuleCompile, this, _1));
+    return;
+  }
+
+  /* every shard sees the same imports, so drop warnings reported more than once */
+  std::string compilerMessages;
+  std::set<std::string> seen;
+  BOOST_FOREACH(const std::string& messages, m_shardMessages) {
+    std::stringstream ss(messages);
+    std::string line;
+    while (std::getline(ss, line)) {
+      if (seen.insert(line).second) {
+        compilerMessages += line + "\n";
+      }
+    }
+  }
+  ruleset->setCompilerMessages(compilerMessages);
+  ruleset->setCatalog(shardCatalog());
+
+  /* publish every shard to the cache */
+  const size_t shardCount = m_shardBinaries.size();
+  m_binaries[ruleset->file()] = m_shardBinaries;
+  m_pending = shardCount;
+  for (size_t i = 0; i < shardCount; ++i) {
+    std::string key = shardKey(ruleset->hash(), i, shardCount);
+    adoptBinary(key, m_shardBinaries[i], m_shardCatalogs[i]);
+    std::string tempFile = m_cache->reserve(key);
+    m_workers[i]->rulesSave(m_shardBinaries[i], tempFile, boost::bind(&RulesetManager::handleShardSave, this, _1, key, tempFile));
+  }
+  m_shardBinaries.clear();
+}
+
+void RulesetManager::handleShardLoad(Scanner::LoadResult::Ref loadResult, size_t index)
+{
+  m_shardBinaries[index] = loadResult->rules;
+  m_shardCatalogs[index] = loadResult->catalog;
+  if (--m_pending) {
+    return; /* wait for the other shards */
+  }
+
+  Ruleset::Ref ruleset = m_queueRules.front();
+
+  if (std::find(m_shardBinaries.begin(), m_shardBinaries.end(), (YR_RULES*)0) != m_shardBinaries.end()) {
+    /* a shard is damaged, rebuild all of them */
+    for (size_t i = 0; i < m_shardBinaries.size(); ++i) {
+      m_cache->remove(shardKey(ruleset->hash(), i, m_shardBinaries.size()));
+    }
+    discardShards();
+    compileRule(ruleset);
+    return;
+  }
+
+  m_binaries[ruleset->file()] = m_shardBinaries;
+  ruleset->setCatalog(shardCatalog());
+  for (size_t i = 0; i < m_shardBinaries.size(); ++i) {
+    adoptBinary(shardKey(ruleset->hash(), i, m_shardBinaries.size()), m_shardBinaries[i], m_shardCatalogs[i]);
+  }
+  m_shardBinaries.clear();
+  m_queueRules.pop_front();
+  compileNextRule();
+}
+
+void RulesetManager::handleShardSave(const std::string& error, const std::string& key, const std::string& tempFile)
+{
+  if (error.empty()) {
+    m_cache->commit(key, tempFile);
+  } else {
+    m_cache->discard(tempFile);
+  }
+  if (--m_pending) {
+    return;
+  }
+  m_queueRules.pop_front();
+  compileNextRule();
+}
+
+void RulesetManager::buildDirectory(Ruleset::Ref ruleset, Scanner::HashResult::Ref hashResult)
+{
+  if (hashResult->hash.empty()) {
+    ruleset->setHash(std::string());
+    ruleset->setPartKeys(std::vector<std::string>());
+    ruleset->setCompilerMessages("No rule files found in \"" + ruleset->file() + "\"\n");
+    m_queueRules.pop_front();
+    compileNextRule();
+    return;
+  }
+
+  std::vector<std::string> keys = hashResult->partHashes;
+  m_partFiles = hashResult->partFiles;
+  const std::vector<std::string> previous = ruleset->partKeys();
+  if (previous.size() == 1 && previous[0] == hashResult->hash && keys.size() > 1 && !m_forceCompile) {
+    /* the parts did not compile on their own last time and nothing has changed since */
+    keys = previous;
+    m_partFiles = std::vector<std::vector<std::string> >(1, allPartFiles());
+  }
+  ruleset->setHash(hashResult->hash);
+  buildParts(ruleset, keys);
+}
+
+void RulesetManager::buildParts(Ruleset::Ref ruleset, const std::vector<std::string>& keys)
+{
+  /* unchanged parts are taken from memory or the cache, the rest compile in parallel */
+  const size_t partCount = keys.size();
+  ruleset->setPartKeys(keys);
+  ruleset->setShardCount(int(partCount));
+  m_shardBinaries = std::vector<YR_RULES*>(partCount);
+  m_shardMessages = std::vector<std::string>(partCount);
+  m_partCompiled = std::vector<bool>(partCount);
+  m_shardCatalogs = std::vector<std::vector<std::string> >(partCount);
+  m_pending = partCount + 1; /* held until every part is started */
+  for (size_t i = 0; i < partCount; ++i) {
+    std::map<std::string, YR_RULES*>::iterator binary = m_resident.find(keys[i]);
+    if (binary != m_resident.end() && !m_forceCompile) {
+      m_shardBinaries[i] = binary->second;
+      m_shardCatalogs[i] = m_residentCatalogs[keys[i]];
+      m_pending--;
+      continue;
+    }
+    std::string ruleCacheFile = m_forceCompile ? std::string() : m_cache->lookup(keys[i]);
+    if (!ruleCacheFile.empty()) {
+      partScanner(i)->rulesLoad(ruleCacheFile, boost::bind(&RulesetManager::handlePartLoad, this, _1, i));
+    } else {
+      m_partCompiled[i] = true;
+      partScanner(i)->rulesCompileFiles(m_partFiles[i], ruleset->file(), boost::bind(&RulesetManager::handlePartCompile, this, _1, i));
+    }
+  }
+  partDone();
+}
+
+void RulesetManager::handlePartCompile(Scanner::CompileResult::Ref compileResult, size_t index)
+{
+  m_shardBinaries[index] = compileResult->rules;
+  m_shardMessages[index] = compileResult->compilerMessages;
+  m_shardCatalogs[index] = compileResult->catalog;
+  partDone();
+}
+
+void RulesetManager::handlePartLoad(Scanner::LoadResult::Ref loadResult, size_t index)
+{
+  Ruleset::Ref ruleset = m_queueRules.front();
+  if (!loadResult->error.empty()) {
+    /* damaged cache entry, build this part again */
+    m_cache->remove(binaryKey(ruleset, index));
+    m_partCompiled[index] = true;
+    partScanner(index)->rulesCompileFiles(m_partFiles[index], ruleset->file(), boost::bind(&RulesetManager::handlePartCompile, this, _1, index));
+    return;
+  }
+  m_shardBinaries[index] = loadResult->rules;
+  m_shardCatalogs[index] = loadResult->catalog;
+  partDone();
+}
+
+void RulesetManager::partDone()
+{
+  if (--m_pending) {
+    return; /* wait for the other parts */
+  }
+
+  Ruleset::Ref ruleset = m_queueRules.front();
+  const size_t partCount = m_shardBinaries.size();
+
+  /* every part sees the same imports, so drop warnings reported more than once */
+  std::string compilerMessages;
+  std::set<std::string> seen;
+  bool rebuilt = false;
+  for (size_t i = 0; i < partCount; ++i) {
+    rebuilt |= m_resident.find(binaryKey(ruleset, i)) == m_resident.end();
+    std::stringstream ss(m_shardMessages[i]);
+    std::string line;
+    while (std::getline(ss, line)) {
+      if (seen.insert(line).second) {
+        compilerMessages += line + "\n";
+      }
+    }
+  }
+
+  if (std::find(m_shardBinaries.begin(), m_shardBinaries.end(), (YR_RULES*)0) != m_shardBinaries.end()) {
+    /* release what this operation built, resident parts are still in use */
+    for (size_t i = 0; i < partCount; ++i) {
+      if (m_shardBinaries[i] && m_resident.find(binaryKey(ruleset, i)) == m_resident.end()) {
+        m_scanner->rulesDestroy(m_shardBinaries[i], boost::bind(&RulesetManager::handleRulesDiscarded, this));
+      }
+    }
+    m_shardBinaries.clear();
+    if (partCount > 1) {
+      /* rules in different files may refer to each other, compile the directory as a whole */
+      m_partFiles = std::vector<std::vector<std::string> >(1, allPartFiles());
+      buildParts(ruleset, std::vector<std::string>(1, ruleset->hash()));
+      return;
+    }
+    ruleset->setCompilerMessages(compilerMessages);
+    ruleset->setHash(std::string());
+    ruleset->setPartKeys(std::vector<std::string>());
+    m_queueRules.pop_front();
+    compileNextRule();
+    return;
+  }
+
+  if (rebuilt) {
+    /* warnings of parts reused from memory were reported when they were built */
+    /* the catalog is made from every current part, parts reused from memory included */
+    ruleset->setCompilerMessages(compilerMessages);
+    ruleset->setCatalog(shardCatalog());
+  }
+
+  /* publish compiled parts to the cache */
+  m_binaries[ruleset->file()] = m_shardBinaries;
+  m_pending = 0;
+  for (size_t i = 0; i < partCount; ++i) {
+    const std::string key = binaryKey(ruleset, i);
+    if (m_resident.find(key) != m_resident.end()) {
+      continue;
+    }
+    adoptBinary(key, m_shardBinaries[i], m_shardCatalogs[i]);
+    if (m_partCompiled[i]) {
+      m_pending++;
+      std::string tempFile = m_cache->reserve(key);
+      partScanner(i)->rulesSave(m_shardBinaries[i], tempFile, boost::bind(&RulesetManager::handleShardSave, this, _1, key, tempFile));
+    }
+  }
+  m_shardBinaries.clear();
+  if (!m_pending) {
+    m_queueRules.pop_front();
+    compileNextRule();
+  }
+}
+
+void RulesetManager::handleRulesDiscarded()
+{
+  /* nothing to do, these rules are no longer used */
+}
+
+void RulesetManager::selectNextRule()
+{
+  /* swap each compiled ruleset for a binary holding only the selected rules */
+  if (m_queueSelect.empty()) {
+    scanWithCompiledRules();
+    return;
+  }
+
+  Ruleset::Ref ruleset = m_queueSelect.front();
+  if (ruleset->isPrecompiled() || ruleset->isDirectory()) {
+    /* no single source to select from, scan with every rule */
+    m_queueSelect.pop_front();
+    selectNextRule();
+    return;
+  }
+
+  const std::string key = selectionKey(ruleset);
+  std::map<std::string, YR_RULES*>::iterator binary = m_resident.find(key);
+  if (binary != m_resident.end()) {
+    m_selectionKeys.insert(key);
+    m_binaries[ruleset->file()] = std::vector<YR_RULES*>(1, binary->second);
+    m_queueSelect.pop_front();
+    selectNextRule();
+    return;
+  }
+
+  std::string ruleCacheFile = m_cache->lookup(key);
+  if (!ruleCacheFile.empty()) {
+    m_scanner->rulesLoad(ruleCacheFile, boost::bind(&RulesetManager::handleSelectionLoad, this, _1));
+  } else {
+    selectRule(ruleset);
+  }
+}
+
+void RulesetManager::selectRule(Ruleset::Ref ruleset)
+{
+  m_scanner->rulesSelect(ruleset->file(), m_selector, selectionNamespace(ruleset), boost::bind(&RulesetManager::handleRuleSelect, this, _1));
+}
+
+void RulesetManager::handleRuleSelect(Scanner::SelectResult::Ref selectResult)
+{
+  Ruleset::Ref ruleset = m_queueSelect.front();
+  if (selectResult->everything || !selectResult->error.empty()) {
+    /* keep the full binary */
+    m_queueSelect.pop_front();
+    selectNextRule();
+  } else if (selectResult->source.empty()) {
+    /* no rule in this file was selected, don't scan with it at all */
+    m_binaries.erase(ruleset->file());
+    m_queueSelect.pop_front();
+    selectNextRule();
+  } else {
+    m_scanner->rulesCompileSource(selectResult->source, ruleset->file(), "", boost::bind(&RulesetManager::handleSelectionCompile, this, _1));
+  }
+}
+
+void RulesetManager::handleSelectionCompile(Scanner::CompileResult::Ref compileResult)
+{
+  Ruleset::Ref ruleset = m_queueSelect.front();
+  if (!compileResult->rules) {
+    /* the full ruleset compiled, so this should not happen. fall back to every rule */
+    m_queueSelect.pop_front();
+    selectNextRule();
+    return;
+  }
+
+  useSelection(ruleset, compileResult->rules);
+
+  /* cache the derived binary like any other */
+  const std::string key = selectionKey(ruleset);
+  std::string tempFile = m_cache->reserve(key);
+  m_scanner->rulesSave(compileResult->rules, tempFile, boost::bind(&RulesetManager::handleSelectionSave, this, _1, tempFile));
+}
+
+void RulesetManager::handleSelectionLoad(Scanner::LoadResult::Ref loadResult)
+{
+  Ruleset::Ref ruleset = m_queueSelect.front();
+  if (!loadResult->error.empty()) {
+    m_cache->remove(selectionKey(ruleset));
+    selectRule(ruleset);
+    return;
+  }
+
+  useSelection(ruleset, loadResult->rules);
+  m_queueSelect.pop_front();
+  selectNextRule();
+}
+
+void RulesetManager::handleSelectionSave(const std::string& error, const std::string& tempFile)
+{
+  Ruleset::Ref ruleset = m_queueSelect.front();
+  if (error.empty()) {
+    m_cache->commit(selectionKey(ruleset), tempFile);
+  } else {
+    m_cache->discard(tempFile);
+  }
+  m_queueSelect.pop_front();
+  selectNextRule();
+}
+
+void RulesetManager::useSelection(Ruleset::Ref ruleset, YR_RULES* rules)
+{
+  /* derived binaries stay resident while the selection is in use, but never go into the bundle */
+  const std::string key = selectionKey(ruleset);
+  m_selectionKeys.insert(key);
+  std::map<std::string, YR_RULES*>::iterator binary = m_resident.find(key);
+  if (binary != m_resident.end() && binary->second != rules) {
+    m_scanner->rulesDestroy(binary->second, boost::bind(&RulesetManager::handleRulesDiscarded, this));
+  }
+  m_resident[key] = rules;
+  m_binaries[ruleset->file()] = std::vector<YR_RULES*>(1, rules);
+}
+
+void RulesetManager::handleBundleLoad(Scanner::BundleResult::Ref bundleResult)
+{
+  if (!bundleResult->error.empty()) {
+    m_bundleDirty = true; /* no usable bundle, write one once rules are compiled */
+  }
+
+  m_resident.insert(bundleResult->rules.begin(), bundleResult->rules.end());
+  m_residentCatalogs.insert(bundleResult->catalogs.begin(), bundleResult->catalogs.end());
+  BOOST_FOREACH(const RuleBundle::Entry& entry, bundleResult->entries) {
+    BOOST_FOREACH(Ruleset::Ref ruleset, m_rules) {
+      if (ruleset->file() == entry.file && ruleset->hash() == entry.hash) {
+        ruleset->setCatalog(entry.catalog);
+      }
+    }
+  }
+
+  /* the bundle may hold rules that were removed by another instance */
+  pruneBinaries();
+}
+
+void RulesetManager::handleBundleSave(const std::string& error)
+{
+  if (!error.empty()) {
+    m_bundleDirty = true; /* try again after the next operation */
+  }
+}
+
 void RulesetManager::compileNextRule()
 {
   /* if there are no more rules to compile, start the scan */
@@ -172,12 +796,117 @@ void RulesetManager::compileNextRule()
     /* before we begin, write any cache updates to the settings file */
     m_settings->setRules(m_rules);
     onRulesUpdated();
-    scanWithCompiledRules();
+    if (!m_selector.isEmpty() && !m_precompiling && !m_queueTargets.empty()) {
+      m_queueSelect = ruleToQueue(m_activeRule, QueueCompiledRules);
+      selectNextRule();
+    } else {
+      scanWithCompiledRules();
+    }
     return;
   }
 
   Ruleset::Ref ruleset = m_queueRules.front();
-  m_scanner->rulesHash(ruleset->file(), boost::bind(&RulesetManager::handleRuleHash, this, _1));
+  if (ruleset->isDirectory()) {
+    startWorkers(); /* the part count follows the worker count */
+    m_scanner->rulesHashDirectory(ruleset->file(), std::max<size_t>(1, m_workers.size()), boost::bind(&RulesetManager::handleRuleHash, this, _1));
+  } else {
+    m_scanner->rulesHash(ruleset->file(), !ruleset->isPrecompiled(), boost::bind(&RulesetManager::handleRuleHash, this, _1));
+  }
+}
+
+void RulesetManager::compileRule(Ruleset::Ref ruleset)
+{
+  if (shouldShard(ruleset)) {
+    startWorkers();
+    m_scanner->rulesSplit(ruleset->file(), m_settings->getShardCount(), boost::bind(&RulesetManager::handleRuleSplit, this, _1));
+  } else {
+    ruleset->setShardCount(1);
+    m_scanner->rulesCompile(ruleset->file(), "", boost::bind(&RulesetManager::handleRuleCompile, this, _1));
+  }
+}
+
+void RulesetManager::discardShards()
+{
+  BOOST_FOREACH(YR_RULES* rules, m_shardBinaries) {
+    if (rules) {
+      m_scanner->rulesDestroy(rules, boost::bind(&RulesetManager::handleRulesDiscarded, this));
+    }
+  }
+  m_shardBinaries.clear();
+}
+
+void RulesetManager::adoptBinary(const std::string& key, YR_RULES* rules, const std::vector<std::string>& catalog)
+{
+  /* keep compiled rules loaded for the next operation and the next bundle */
+  std::map<std::string, YR_RULES*>::iterator binary = m_resident.find(key);
+  if (binary != m_resident.end() && binary->second != rules) {
+    m_scanner->rulesDestroy(binary->second, boost::bind(&RulesetManager::handleRulesDiscarded, this));
+  }
+  m_resident[key] = rules;
+  m_residentCatalogs[key] = catalog;
+  m_bundleDirty = true;
+}
+
+std::vector<std::string> RulesetManager::shardCatalog() const
+{
+  std::vector<std::string> catalog;
+  BOOST_FOREACH(const std::vector<std::string>& shard, m_shardCatalogs) {
+    catalog.insert(catalog.end(), shard.begin(), shard.end());
+  }
+  return catalog;
+}
+
+void RulesetManager::pruneBinaries()
+{
+  /* destroy binaries of rules that were edited or removed */
+  std::set<std::string> keys;
+  BOOST_FOREACH(Ruleset::Ref ruleset, m_rules) {
+    for (int i = 0; i < ruleset->shardCount(); ++i) {
+      keys.insert(binaryKey(ruleset, i));
+    }
+  }
+  keys.insert(m_selectionKeys.begin(), m_selectionKeys.end());
+
+  std::map<std::string, YR_RULES*>::iterator binary = m_resident.begin();
+  while (binary != m_resident.end()) {
+    if (keys.find(binary->first) == keys.end()) {
+      m_scanner->rulesDestroy(binary->second, boost::bind(&RulesetManager::handleRulesDiscarded, this));
+      m_bundleDirty |= !isSelectionKey(binary->first); /* derived binaries are never bundled */
+      m_residentCatalogs.erase(binary->first);
+      m_resident.erase(binary++);
+    } else {
+      binary++;
+    }
+  }
+}
+
+void RulesetManager::saveBundle()
+{
+  std::vector<RuleBundle::Entry> entries;
+  BOOST_FOREACH(Ruleset::Ref ruleset, m_rules) {
+    RuleBundle::Entry entry;
+    entry.file = ruleset->file();
+    entry.name = ruleset->name();
+    entry.hash = ruleset->hash();
+    entry.catalog = ruleset->catalog();
+    const size_t shardCount = ruleset->shardCount();
+    for (size_t i = 0; i < shardCount; ++i) {
+      RuleBundle::Binary binary;
+      binary.key = binaryKey(ruleset, i);
+      binary.offset = 0;
+      binary.size = 0;
+      if (m_resident.find(binary.key) == m_resident.end()) {
+        break; /* never compiled, or failed to compile */
+      }
+      entry.binaries.push_back(binary);
+    }
+    if (entry.binaries.size() == shardCount) {
+      entries.push_back(entry);
+    }
+  }
+
+  m_bundleDirty = false;
+  m_scanner->bundleSave(bundleFile(), entries, m_resident, boost::bind(&RulesetManager::handleBundleSave, this, _1));
 }
 
 void RulesetManager::scanWithCompiledRules()
@@ -213,23 +942,58 @@ void RulesetManager::scanWithCompiledRules()
     return;
   }
 
-  YR_RULES* rules = m_binaries[m_queueRules.front()->file()];
-  m_scanner->scanStart(rules, target, 0,
-    boost::bind(&RulesetManager::handleScanResult, this, _1),
-    boost::bind(&RulesetManager::handleScanComplete, this, _1));
+  const std::vector<YR_RULES*>& rules = m_binaries[m_queueRules.front()->file()];
+  if (rules.size() == 1) {
+    m_pending = 1;
+    m_scanner->scanStart(rules[0], target, 0,
+      boost::bind(&RulesetManager::handleScanResult, this, _1),
+      boost::bind(&RulesetManager::handleScanComplete, this, _1));
+    return;
+  }
+
+  /* scan all shards at once, the results are reported against the one ruleset */
+  m_pending = rules.size();
+  for (size_t i = 0; i < rules.size(); ++i) {
+    m_workers[i]->scanStart(rules[i], target, 0,
+      boost::bind(&RulesetManager::handleScanResult, this, _1),
+      boost::bind(&RulesetManager::handleScanComplete, this, _1));
+  }
 }
 
 void RulesetManager::freeBinaries()
 {
-  if (m_binaries.empty()) {
+  /* binaries stay resident for the next scan, only those no longer needed are destroyed */
+  m_binaries.clear();
+  pruneBinaries();
+  if (m_bundleDirty) {
+    saveBundle();
+  }
+
+  m_busy = false;
+  if (m_precompiling) {
+    m_precompiling = false; /* background work is not reported as a scan */
+  } else {
     onScanComplete(std::string());
+  }
+
+  /* user requests take priority over further background compiles */
+  if (!m_deferred.empty()) {
+    m_io.post(boost::bind(&RulesetManager::startDeferred, this));
   } else {
-    YR_RULES* rules = m_binaries.begin()->second;
-    m_binaries.erase(m_binaries.begin()->first);
-    m_scanner->rulesDestroy(rules, boost::bind(&RulesetManager::freeBinaries, this));
+    m_io.post(boost::bind(&RulesetManager::precompileNext, this));
   }
 }
 
+void RulesetManager::startDeferred()
+{
+  if (m_busy || m_deferred.empty()) {
+    return;
+  }
+  const Request request = m_deferred.front();
+  m_deferred.pop_front();
+  begin(request);
+}
+
 std::list<Ruleset::Ref> RulesetManager::ruleToQueue(Ruleset::Ref rule, const QueueType type)
 {
   std::list<Ruleset::Ref> rules;
@@ -244,7 +1008,7 @@ std::list<Ruleset::Ref> RulesetManager::ruleToQueue(Ruleset::Ref rule, const Que
   }
 
   /* return compiled rules only */
-  typedef std::map<std::string, YR_RULES*>::value_type Binary;
+  typedef std::map<std::string, std::vector<YR_RULES*> >::value_type Binary;
   BOOST_FOREACH(Binary& binary, m_binaries) {
     BOOST_FOREACH(Ruleset::Ref src, m_rules) {
       if (binary.first == src->file()) { /* this is a compiled rule */
@@ -274,15 +1038,82 @@ Ruleset::Ref RulesetManager::viewToRule(RulesetView::Ref view)
   return createRule(view->file());
 }
 
-std::string RulesetManager::compiledRuleCache(const std::string& hash) const
+bool RulesetManager::shouldShard(Ruleset::Ref ruleset) const
+{
+  if (m_settings->getShardCount() < 2) {
+    return false; /* sharding is disabled */
+  }
+  QFileInfo fileInfo(ruleset->file().c_str());
+  return uint64_t(fileInfo.size()) >= m_settings->getShardThreshold();
+}
+
+std::string RulesetManager::shardKey(const std::string& hash, size_t index, size_t count) const
 {
-  /* store cached compiled rules in the executable path */
-  if (hash.empty()) {
-    return std::string();
+  /* an unsharded rule is stored under its plain hash */
+  if (count < 2) {
+    return hash;
   }
-  QDir dir = QCoreApplication::applicationDirPath();
-  QString cacheDirName = "cache";
-  QString cacheDir = cacheDirName + QDir::separator() + hash.c_str();
-  QString file = dir.absoluteFilePath(cacheDir);
-  return file.toStdString();
+  std::stringstream ss;
+  ss << hash << "-" << index + 1 << "of" << count;
+  return ss.str();
+}
+
+std::string RulesetManager::selectionKey(Ruleset::Ref ruleset) const
+{
+  /* the same selection of the same source under the same namespace always gives the same binary */
+  const std::string selection = ruleset->hash() + "\n" + selectionNamespace(ruleset) + "\n" + m_selector.expression();
+  QByteArray hash = QCryptographicHash::hash(QByteArray(selection.c_str(), int(selection.size())), QCryptographicHash::Md5).toHex();
+  return "select-" + std::string(hash.constData(), hash.length());
+}
+
+std::string RulesetManager::selectionNamespace(Ruleset::Ref ruleset) const
+{
+  return ruleset->name().empty() ? ruleset->view()->fileNameOnly() : ruleset->name();
+}
+
+bool RulesetManager::isSelectionKey(const std::string& key) const
+{
+  return key.compare(0, 7, "select-") == 0;
+}
+
+std::string RulesetManager::binaryKey(Ruleset::Ref ruleset, size_t index) const
+{
+  /* directory parts are keyed by their own files, so an edit only invalidates one part */
+  if (ruleset->isDirectory()) {
+    std::vector<std::string> keys = ruleset->partKeys();
+    return index < keys.size() ? keys[index] : std::string();
+  }
+  return shardKey(ruleset->hash(), index, ruleset->shardCount());
+}
+
+void RulesetManager::startWorkers()
+{
+  /* extra scanner threads so the shards of a large rule file and the parts of a rule directory compile and scan */
+  /* in parallel. started the first time either is built, most rule lists never need them */
+  const int workerCount = std::max(m_settings->getShardCount(), m_settings->getCompileThreads());
+  for (int i = int(m_workers.size()); workerCount > 1 && i < workerCount; ++i) {
+    m_workers.push_back(boost::make_shared<Scanner>(boost::ref(m_io)));
+  }
+}
+
+boost::shared_ptr<Scanner> RulesetManager::partScanner(size_t index) const
+{
+  /* scans use the same rule: one binary on the main scanner, several on the workers */
+  return m_workers.empty() || m_shardBinaries.size() < 2 ? m_scanner : m_workers[index];
+}
+
+std::vector<std::string> RulesetManager::allPartFiles() const
+{
+  std::vector<std::string> files;
+  BOOST_FOREACH(const std::vector<std::string>& part, m_partFiles) {
+    files.insert(files.end(), part.begin(), part.end());
+  }
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
+std::string RulesetManager::bundleFile() const
+{
+  QDir dir(m_cache->directory().c_str());
+  return dir.absoluteFilePath("rules.bundle").toStdString();
 }
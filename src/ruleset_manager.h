@@ -7,10 +7,15 @@
 #include "ruleset.h"
 #include "scanner.h"
 #include "settings.h"
+#include "rule_cache.h"
+#include "rule_watcher.h"
+#include "target_prefetcher.h"
 #include <boost/asio.hpp>
 #include <boost/signals2.hpp>
 #include <vector>
 #include <list>
+#include <map>
+#include <set>
 
 class RulesetManager
 {
@@ -25,6 +30,7 @@ public:
 
   void scan(const std::string& target, RulesetView::Ref view);
   void scan(const std::vector<std::string>& targets, RulesetView::Ref view);
+  void scan(const std::vector<std::string>& targets, RulesetView::Ref view, const RuleSelector& selector);
   void scanAbort();
   void compile(RulesetView::Ref view);
 
@@ -34,14 +40,55 @@ public:
 
 private:
 
+  struct Request
+  {
+    std::list<std::string> targets; /* empty for a compile */
+    Ruleset::Ref rule;
+    RuleSelector selector;
+    bool forceCompile;
+  };
+
+  void start(const std::list<std::string>& targets, Ruleset::Ref rule, const RuleSelector& selector, bool forceCompile);
+  void begin(const Request& request);
+  void startDeferred();
+  void precompileNext();
+  void watchRules();
+
+  void handleRuleFileChanged(const std::string& file);
   void handleRuleCompile(Scanner::CompileResult::Ref compileResult);
   void handleScanResult(ScannerRule::Ref rule);
   void handleScanComplete(const std::string& error);
-  void handleRuleHash(const std::string& hash);
+  void handleRuleHash(Scanner::HashResult::Ref hashResult);
   void handleRuleLoad(Scanner::LoadResult::Ref loadResult);
-  void handleRuleSave(const std::string& error);
+  void handlePrecompiledLoad(Scanner::LoadResult::Ref loadResult);
+  void handleRuleSave(const std::string& error, const std::string& key, const std::string& tempFile);
+  void handleRuleSplit(Scanner::SplitResult::Ref splitResult);
+  void handleShardCompile(Scanner::CompileResult::Ref compileResult, size_t index);
+  void handleShardLoad(Scanner::LoadResult::Ref loadResult, size_t index);
+  void handleShardSave(const std::string& error, const std::string& key, const std::string& tempFile);
+  void handleRulesDiscarded();
+  void handlePartCompile(Scanner::CompileResult::Ref compileResult, size_t index);
+  void handlePartLoad(Scanner::LoadResult::Ref loadResult, size_t index);
+  void handleRuleSelect(Scanner::SelectResult::Ref selectResult);
+  void handleSelectionCompile(Scanner::CompileResult::Ref compileResult);
+  void handleSelectionLoad(Scanner::LoadResult::Ref loadResult);
+  void handleSelectionSave(const std::string& error, const std::string& tempFile);
+  void handleBundleLoad(Scanner::BundleResult::Ref bundleResult);
+  void handleBundleSave(const std::string& error);
 
   void compileNextRule();
+  void selectNextRule();
+  void selectRule(Ruleset::Ref ruleset);
+  void useSelection(Ruleset::Ref ruleset, YR_RULES* rules);
+  void compileRule(Ruleset::Ref ruleset);
+  void discardShards();
+  void buildDirectory(Ruleset::Ref ruleset, Scanner::HashResult::Ref hashResult);
+  void buildParts(Ruleset::Ref ruleset, const std::vector<std::string>& keys);
+  void partDone();
+  void adoptBinary(const std::string& key, YR_RULES* rules, const std::vector<std::string>& catalog);
+  std::vector<std::string> shardCatalog() const;
+  void pruneBinaries();
+  void saveBundle();
   void scanWithCompiledRules();
   void freeBinaries();
 
@@ -52,21 +99,50 @@ private:
 
   std::list<Ruleset::Ref> ruleToQueue(Ruleset::Ref rule, const QueueType type);
   Ruleset::Ref viewToRule(RulesetView::Ref view);
-  std::string compiledRuleCache(const std::string& hash) const;
+  bool shouldShard(Ruleset::Ref ruleset) const;
+  std::string shardKey(const std::string& hash, size_t index, size_t count) const;
+  std::string binaryKey(Ruleset::Ref ruleset, size_t index) const;
+  void startWorkers();
+  boost::shared_ptr<Scanner> partScanner(size_t index) const;
+  std::vector<std::string> allPartFiles() const;
+  std::string bundleFile() const;
+  std::string selectionKey(Ruleset::Ref ruleset) const;
+  std::string selectionNamespace(Ruleset::Ref ruleset) const; /* what ns: terms are matched against */
+  bool isSelectionKey(const std::string& key) const;
 
   boost::asio::io_service& m_io;
   boost::shared_ptr<Scanner> m_scanner;
+  std::vector<boost::shared_ptr<Scanner> > m_workers; /* one per shard of a large rule file */
   boost::shared_ptr<Settings> m_settings;
+  RuleCache::Ref m_cache;
+  RuleWatcher::Ref m_watcher;
+  TargetPrefetcher::Ref m_prefetcher;
 
   std::vector<Ruleset::Ref> m_rules;
-  std::map<std::string, YR_RULES*> m_binaries;
+  std::map<std::string, std::vector<YR_RULES*> > m_binaries; /* more than one if the rule is sharded */
+  std::map<std::string, YR_RULES*> m_resident; /* every loaded binary by cache key, kept between scans */
+  std::map<std::string, std::vector<std::string> > m_residentCatalogs; /* rule identifiers of each resident binary, so reused parts need no walk of the rules */
+  std::vector<YR_RULES*> m_shardBinaries; /* shards of the rule at the front of the queue */
+  std::vector<std::string> m_shardMessages;
+  std::vector<std::vector<std::string> > m_shardCatalogs; /* rule identifiers of each shard or part */
+  std::vector<std::vector<std::string> > m_partFiles; /* rule files of each part of the directory at the front of the queue */
+  std::vector<bool> m_partCompiled;
+  size_t m_pending; /* outstanding shard operations or concurrent scans */
 
   Ruleset::Ref m_activeRule;
   std::list<std::string> m_queueTargets;
   std::list<Ruleset::Ref> m_queueRules;
+  std::list<Ruleset::Ref> m_queuePrecompile;
+  std::list<Ruleset::Ref> m_queueSelect; /* rulesets still to be narrowed down to the selected rules */
+  RuleSelector m_selector;
+  std::set<std::string> m_selectionKeys; /* resident derived binaries of the current selection */
+  std::list<Request> m_deferred; /* user requests waiting for the operation in progress, run in order */
 
   bool m_forceCompile;
   bool m_scanAborted;
+  bool m_busy;
+  bool m_precompiling;
+  bool m_bundleDirty; /* resident binaries differ from the bundle on disk */
 
 };
 
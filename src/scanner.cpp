@@ -1,10 +1,16 @@
 #include "scanner.h"
+#include "rule_parser.h"
+#include "rule_linter.h"
 #include <sstream>
 #include <fstream>
 #include <boost/make_shared.hpp>
+#include <boost/foreach.hpp>
+#include <algorithm>
+#include <string.h>
 #include <QtCore/QCryptographicHash>
 #include <QtCore/QFileInfo>
 #include <QtCore/QDir>
+#include <QtCore/QDirIterator>
 #include <yara.h>
 
 Scanner::~Scanner()
@@ -18,9 +24,14 @@ Scanner::Scanner(boost::asio::io_service& caller) : m_caller(caller), m_scanRunn
   m_thread = boost::make_shared<boost::thread>(boost::bind(&Scanner::thread, this));
 }
 
-void Scanner::rulesHash(const std::string& file, RulesHashCallback callback)
+void Scanner::rulesHash(const std::string& file, bool followIncludes, RulesHashCallback callback)
 {
-  m_io.post(boost::bind(&Scanner::threadRulesHash, this, file, callback));
+  m_io.post(boost::bind(&Scanner::threadRulesHash, this, file, followIncludes, callback));
+}
+
+void Scanner::rulesHashDirectory(const std::string& directory, size_t partCount, RulesHashCallback callback)
+{
+  m_io.post(boost::bind(&Scanner::threadRulesHashDirectory, this, directory, partCount, callback));
 }
 
 void Scanner::rulesCompile(const std::string& file, const std::string& ns, RulesCompileCallback callback)
@@ -28,6 +39,26 @@ void Scanner::rulesCompile(const std::string& file, const std::string& ns, Rules
   m_io.post(boost::bind(&Scanner::threadRulesCompile, this, file, ns, callback));
 }
 
+void Scanner::rulesCompileFiles(const std::vector<std::string>& files, const std::string& label, RulesCompileCallback callback)
+{
+  m_io.post(boost::bind(&Scanner::threadRulesCompileFiles, this, files, label, callback));
+}
+
+void Scanner::rulesCompileSource(const std::string& source, const std::string& file, const std::string& ns, RulesCompileCallback callback)
+{
+  m_io.post(boost::bind(&Scanner::threadRulesCompileSource, this, source, file, ns, callback));
+}
+
+void Scanner::rulesSplit(const std::string& file, size_t shardCount, RulesSplitCallback callback)
+{
+  m_io.post(boost::bind(&Scanner::threadRulesSplit, this, file, shardCount, callback));
+}
+
+void Scanner::rulesSelect(const std::string& file, const RuleSelector& selector, const std::string& ns, RulesSelectCallback callback)
+{
+  m_io.post(boost::bind(&Scanner::threadRulesSelect, this, file, selector, ns, callback));
+}
+
 void Scanner::rulesSave(YR_RULES* rules, const std::string& file, RulesSaveCallback callback)
 {
   m_io.post(boost::bind(&Scanner::threadRulesSave, this, rules, file, callback));
@@ -43,6 +74,16 @@ void Scanner::rulesDestroy(YR_RULES* rules, RulesDestroyCallback callback)
   m_io.post(boost::bind(&Scanner::threadRulesDestroy, this, rules, callback));
 }
 
+void Scanner::bundleLoad(const std::string& file, BundleLoadCallback callback)
+{
+  m_io.post(boost::bind(&Scanner::threadBundleLoad, this, file, callback));
+}
+
+void Scanner::bundleSave(const std::string& file, const std::vector<RuleBundle::Entry>& entries, const std::map<std::string, YR_RULES*>& rules, RulesSaveCallback callback)
+{
+  m_io.post(boost::bind(&Scanner::threadBundleSave, this, file, entries, rules, callback));
+}
+
 void Scanner::scanStart(YR_RULES* rules, const std::string& file, int timeout, ScanResultCallback resultCallback, ScanCompleteCallback completeCallback)
 {
   if (!m_scanRunning) {
@@ -55,28 +96,68 @@ void Scanner::scanStop()
   m_scanAborted = true;
 }
 
-void Scanner::threadRulesHash(const std::string& file, RulesHashCallback callback)
+void Scanner::threadRulesHash(const std::string& file, bool followIncludes, RulesHashCallback callback)
 {
-  std::ifstream input(file.c_str(), std::ifstream::binary);
-  if (!input.is_open()) {
-    m_caller.post(boost::bind(callback, std::string()));
+  HashResult::Ref result = boost::make_shared<HashResult>();
+  if (!hashRules(file, followIncludes, result->hash, result->dependencies)) {
+    result->hash.clear();
+  }
+  m_caller.post(boost::bind(callback, result));
+}
+
+void Scanner::threadRulesHashDirectory(const std::string& directory, size_t partCount, RulesHashCallback callback)
+{
+  HashResult::Ref result = boost::make_shared<HashResult>();
+  QDir dir(directory.c_str());
+  if (!dir.exists()) {
+    m_caller.post(boost::bind(callback, result));
     return;
   }
 
-  QCryptographicHash hash(QCryptographicHash::Md5);
-  std::vector<char> buffer(50 * 1024);
-  while (!input.eof()) {
-    input.read(&buffer[0], buffer.size());
-    if (input.bad()) {
-      m_caller.post(boost::bind(callback, std::string()));
-      return;
+  /* sub directories are watched too, so added files trigger a rebuild */
+  QDirIterator dirs(directory.c_str(), QDir::Dirs | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+  while (dirs.hasNext()) {
+    result->dependencies.push_back(QDir::cleanPath(dirs.next()).toStdString());
+  }
+
+  std::vector<std::string> files;
+  QDirIterator entries(directory.c_str(), QStringList() << "*.yar" << "*.yara", QDir::Files, QDirIterator::Subdirectories);
+  while (entries.hasNext()) {
+    files.push_back(QDir::cleanPath(entries.next()).toStdString());
+  }
+  std::sort(files.begin(), files.end());
+
+  /* each file always lands in the same part, so an edit only changes the hash of its own part */
+  partCount = std::max<size_t>(1, partCount);
+  std::vector<std::vector<std::string> > parts(partCount);
+  std::vector<std::string> fingerprints(partCount);
+  BOOST_FOREACH(const std::string& file, files) {
+    std::string hash;
+    if (!hashRules(file, true, hash, result->dependencies)) {
+      hash = "missing";
     }
-    hash.addData(&buffer[0], input.gcount());
+    const std::string relative = dir.relativeFilePath(file.c_str()).toStdString();
+    uint32_t bucket = 2166136261u; /* fnv-1a, stable between runs */
+    BOOST_FOREACH(char c, relative) {
+      bucket = (bucket ^ (unsigned char)c) * 16777619u;
+    }
+    parts[bucket % partCount].push_back(file);
+    fingerprints[bucket % partCount] += relative + " " + hash + "\n";
+    result->dependencies.push_back(file);
   }
 
-  QByteArray hashBytes = hash.result().toHex();
-  std::string hashString(hashBytes.constData(), hashBytes.length());
-  m_caller.post(boost::bind(callback, hashString));
+  std::string fingerprint;
+  for (size_t i = 0; i < partCount; ++i) {
+    if (!parts[i].empty()) {
+      result->partFiles.push_back(parts[i]);
+      result->partHashes.push_back(md5(fingerprints[i]));
+      fingerprint += result->partHashes.back() + "\n";
+    }
+  }
+  if (!files.empty()) {
+    result->hash = md5(fingerprint);
+  }
+  m_caller.post(boost::bind(callback, result));
 }
 
 void Scanner::threadRulesCompile(const std::string& file, const std::string& ns, RulesCompileCallback callback)
@@ -130,14 +211,185 @@ void Scanner::threadRulesCompile(const std::string& file, const std::string& ns,
     return;
   }
 
-  YR_RULE* rule = 0;
-  yr_rules_foreach(result->rules, rule) {
-    result->ruleCount++;
+  result->catalog = ruleCatalog(result->rules);
+  result->ruleCount = int(result->catalog.size());
+
+  /* the rules are valid, check them for slow strings */
+  std::string source;
+  if (readFile(file, source)) {
+    result->compilerMessages += RuleLinter(source).report(file);
+  }
+
+  m_caller.post(boost::bind(callback, result)); /* success */
+}
+
+void Scanner::threadRulesCompileFiles(const std::vector<std::string>& files, const std::string& label, RulesCompileCallback callback)
+{
+  /* several files into one binary, compiler messages name the file they came from */
+  CompileResult::Ref result = boost::make_shared<CompileResult>();
+  result->rules = 0;
+  result->ruleCount = 0;
+  result->file = label;
+
+  if (m_yaraInitStatus != ERROR_SUCCESS) {
+    result->error = yaraErrorToString(m_yaraInitStatus);
+    m_caller.post(boost::bind(callback, result));
+    return;
+  }
+
+  YR_COMPILER* compiler = 0;
+  int createResult = yr_compiler_create(&compiler);
+  if (createResult != ERROR_SUCCESS) {
+    result->error = "Failed to compile rules: " + yaraErrorToString(createResult);
+    m_caller.post(boost::bind(callback, result));
+    return;
+  }
+
+  yr_compiler_set_callback(compiler, yaraCompilerCallback, &result);
+  int errorCount = 0;
+  BOOST_FOREACH(const std::string& file, files) {
+    FILE* fd = fopen(file.c_str(), "r");
+    if (!fd) {
+      result->compilerMessages += file + "(0): error: could not open file\n";
+      errorCount++;
+      continue;
+    }
+    errorCount += yr_compiler_add_file(compiler, fd, 0, file.c_str());
+    fclose(fd);
+    if (errorCount) {
+      break; /* yara does not accept more input after an error */
+    }
+  }
+
+  if (errorCount) {
+    result->error = "Failed to compile rules: Rules contain errors.";
+    yr_compiler_destroy(compiler);
+    m_caller.post(boost::bind(callback, result));
+    return;
+  }
+
+  int rulesResult = yr_compiler_get_rules(compiler, &result->rules);
+  yr_compiler_destroy(compiler);
+
+  if (rulesResult != ERROR_SUCCESS) {
+    result->error = "Failed to compile rules: " + yaraErrorToString(rulesResult);
+    m_caller.post(boost::bind(callback, result));
+    return;
+  }
+
+  result->catalog = ruleCatalog(result->rules);
+  result->ruleCount = int(result->catalog.size());
+
+  BOOST_FOREACH(const std::string& file, files) {
+    std::string source;
+    if (readFile(file, source)) {
+      result->compilerMessages += RuleLinter(source).report(file);
+    }
+  }
+
+  m_caller.post(boost::bind(callback, result)); /* success */
+}
+
+void Scanner::threadRulesCompileSource(const std::string& source, const std::string& file, const std::string& ns, RulesCompileCallback callback)
+{
+  /* compile rules held in memory, file is only used to label compiler messages */
+  CompileResult::Ref result = boost::make_shared<CompileResult>();
+  result->rules = 0;
+  result->ruleCount = 0;
+  result->file = file;
+  result->ns = ns;
+
+  if (m_yaraInitStatus != ERROR_SUCCESS) {
+    result->error = yaraErrorToString(m_yaraInitStatus);
+    m_caller.post(boost::bind(callback, result));
+    return;
+  }
+
+  YR_COMPILER* compiler = 0;
+  int createResult = yr_compiler_create(&compiler);
+  if (createResult != ERROR_SUCCESS) {
+    result->error = "Failed to compile rules: " + yaraErrorToString(createResult);
+    m_caller.post(boost::bind(callback, result));
+    return;
+  }
+
+  yr_compiler_set_callback(compiler, yaraCompilerCallback, &result);
+  const char* nsOrNull = ns.empty() ? 0 : ns.c_str(); /* yara crashes if you pass an empty string */
+  int errorCount = yr_compiler_add_string(compiler, source.c_str(), nsOrNull);
+
+  if (errorCount) {
+    result->error = "Failed to compile rules: Rules contain errors.";
+    yr_compiler_destroy(compiler);
+    m_caller.post(boost::bind(callback, result));
+    return;
   }
 
+  int rulesResult = yr_compiler_get_rules(compiler, &result->rules);
+  yr_compiler_destroy(compiler);
+
+  if (rulesResult != ERROR_SUCCESS) {
+    result->error = "Failed to compile rules: " + yaraErrorToString(rulesResult);
+    m_caller.post(boost::bind(callback, result));
+    return;
+  }
+
+  result->catalog = ruleCatalog(result->rules);
+  result->ruleCount = int(result->catalog.size());
+  result->compilerMessages += RuleLinter(source).report(file);
+
   m_caller.post(boost::bind(callback, result)); /* success */
 }
 
+void Scanner::threadRulesSplit(const std::string& file, size_t shardCount, RulesSplitCallback callback)
+{
+  SplitResult::Ref result = boost::make_shared<SplitResult>();
+  result->file = file;
+
+  std::string source;
+  if (!readFile(file, source)) {
+    result->error = "Failed to split rules: Error loading file: \"" + file + "\"";
+    m_caller.post(boost::bind(callback, result));
+    return;
+  }
+
+  RuleParser parser(source);
+  result->shards = parser.shard(shardCount);
+  m_caller.post(boost::bind(callback, result));
+}
+
+void Scanner::threadRulesSelect(const std::string& file, const RuleSelector& selector, const std::string& ns, RulesSelectCallback callback)
+{
+  SelectResult::Ref result = boost::make_shared<SelectResult>();
+  result->everything = true;
+
+  std::string source;
+  if (!readFile(file, source)) {
+    result->error = "Failed to select rules: Error loading file: \"" + file + "\"";
+    m_caller.post(boost::bind(callback, result));
+    return;
+  }
+
+  RuleParser parser(source);
+  if (!parser.isValid() || !parser.includes().empty()) {
+    m_caller.post(boost::bind(callback, result)); /* scan with every rule */
+    return;
+  }
+
+  const std::vector<RuleParser::Rule>& rules = parser.rules();
+  std::vector<bool> selected(rules.size());
+  size_t count = 0;
+  for (size_t i = 0; i < rules.size(); ++i) {
+    selected[i] = selector.matches(ns, rules[i].identifier, rules[i].tags);
+    count += selected[i] ? 1 : 0;
+  }
+
+  result->everything = count == rules.size();
+  if (count && !result->everything) {
+    result->source = parser.subset(selected);
+  }
+  m_caller.post(boost::bind(callback, result));
+}
+
 void Scanner::threadRulesSave(YR_RULES* rules, const std::string& file, RulesSaveCallback callback)
 {
   if (m_yaraInitStatus != ERROR_SUCCESS) {
@@ -179,6 +431,7 @@ void Scanner::threadRulesLoad(const std::string& file, RulesLoadCallback callbac
     return;
   }
 
+  result->catalog = ruleCatalog(result->rules);
   m_caller.post(boost::bind(callback, result)); /* success */
 }
 
@@ -188,6 +441,96 @@ void Scanner::threadRulesDestroy(YR_RULES* rules, RulesDestroyCallback callback)
   m_caller.post(callback);
 }
 
+void Scanner::threadBundleLoad(const std::string& file, BundleLoadCallback callback)
+{
+  BundleResult::Ref result = boost::make_shared<BundleResult>();
+
+  if (m_yaraInitStatus != ERROR_SUCCESS) {
+    result->error = yaraErrorToString(m_yaraInitStatus);
+    m_caller.post(boost::bind(callback, result));
+    return;
+  }
+
+  RuleBundle bundle(file);
+  if (!bundle.isValid()) {
+    result->error = "Failed to load rule bundle: \"" + file + "\"";
+    m_caller.post(boost::bind(callback, result));
+    return;
+  }
+
+  /* compiled rules are read straight out of the mapped bundle */
+  BOOST_FOREACH(const RuleBundle::Entry& entry, bundle.entries()) {
+    std::map<std::string, YR_RULES*> loaded;
+    BOOST_FOREACH(const RuleBundle::Binary& binary, entry.binaries) {
+      MemoryStream memory;
+      memory.data = (uint8_t*)bundle.data(binary);
+      memory.size = binary.size;
+      memory.pos = 0;
+      YR_STREAM stream;
+      stream.user_data = &memory;
+      stream.read = yaraStreamRead;
+      stream.write = 0;
+      YR_RULES* rules = 0;
+      if (yr_rules_load_stream(&stream, &rules) != ERROR_SUCCESS) {
+        break;
+      }
+      loaded[binary.key] = rules;
+    }
+    if (loaded.size() != entry.binaries.size()) {
+      /* a ruleset is only usable if all of its shards loaded */
+      typedef std::map<std::string, YR_RULES*>::value_type Loaded;
+      BOOST_FOREACH(Loaded& rules, loaded) {
+        yr_rules_destroy(rules.second);
+      }
+      continue;
+    }
+    result->rules.insert(loaded.begin(), loaded.end());
+    result->entries.push_back(entry);
+    typedef std::map<std::string, YR_RULES*>::value_type Loaded;
+    BOOST_FOREACH(const Loaded& rules, loaded) {
+      result->catalogs[rules.first] = ruleCatalog(rules.second);
+    }
+  }
+
+  m_caller.post(boost::bind(callback, result));
+}
+
+void Scanner::threadBundleSave(const std::string& file, const std::vector<RuleBundle::Entry>& entries, const std::map<std::string, YR_RULES*>& rules, RulesSaveCallback callback)
+{
+  if (m_yaraInitStatus != ERROR_SUCCESS) {
+    m_caller.post(boost::bind(callback, yaraErrorToString(m_yaraInitStatus)));
+    return;
+  }
+
+  std::vector<std::vector<char> > blobs;
+  BOOST_FOREACH(const RuleBundle::Entry& entry, entries) {
+    BOOST_FOREACH(const RuleBundle::Binary& binary, entry.binaries) {
+      std::map<std::string, YR_RULES*>::const_iterator i = rules.find(binary.key);
+      if (i == rules.end()) {
+        m_caller.post(boost::bind(callback, std::string("Missing compiled rules for ") + binary.key));
+        return;
+      }
+      blobs.push_back(std::vector<char>());
+      YR_STREAM stream;
+      stream.user_data = &blobs.back();
+      stream.read = 0;
+      stream.write = yaraStreamWrite;
+      int saveResult = yr_rules_save_stream(i->second, &stream);
+      if (saveResult != ERROR_SUCCESS) {
+        m_caller.post(boost::bind(callback, yaraErrorToString(saveResult)));
+        return;
+      }
+    }
+  }
+
+  if (!RuleBundle::write(file, entries, blobs)) {
+    m_caller.post(boost::bind(callback, std::string("Failed to write rule bundle: \"") + file + "\""));
+    return;
+  }
+
+  m_caller.post(boost::bind(callback, std::string())); /* success */
+}
+
 void Scanner::threadScanStart(YR_RULES* rules, const std::string& file, int timeout, ScanResultCallback resultCallback, ScanCompleteCallback completeCallback)
 {
   if (m_yaraInitStatus != ERROR_SUCCESS) {
@@ -206,9 +549,10 @@ void Scanner::threadScanStart(YR_RULES* rules, const std::string& file, int time
     error = yaraErrorToString(scanResult);
   }
 
-  m_caller.post(boost::bind(completeCallback, error));
-
+  /* clear the flag first, the caller may start the next scan as soon as it is notified */
   m_scanRunning = false;
+
+  m_caller.post(boost::bind(completeCallback, error));
 }
 
 void Scanner::thread()
@@ -262,10 +606,110 @@ void Scanner::yaraCompilerCallback(int errorLevel, const char* fileName, int lin
   }
 
   std::stringstream ss;
-  ss << result->file << "(" << lineNumber << "): " << severity << ": " << message << std::endl;
+  /* yara names the file for add_file and includes, in memory sources fall back to the label */
+  ss << (fileName ? std::string(fileName) : result->file) << "(" << lineNumber << "): " << severity << ": " << message << std::endl;
   result->compilerMessages += ss.str();
 }
 
+bool Scanner::hashRules(const std::string& file, bool followIncludes, std::string& hash, std::vector<std::string>& dependencies)
+{
+  std::string source;
+  if (!readFile(file, source)) {
+    return false;
+  }
+
+  /* fold the fingerprint of every included file into the key, so editing one invalidates the cached binary */
+  /* files without includes keep the plain hash of their source */
+  std::set<std::string> visited;
+  visited.insert(QDir::cleanPath(QFileInfo(file.c_str()).absoluteFilePath()).toStdString());
+  std::vector<std::string> included;
+  std::string fingerprint;
+  if (followIncludes) {
+    hashIncludes(file, source, visited, included, fingerprint);
+  }
+
+  hash = md5(source);
+  if (!included.empty()) {
+    hash = md5(hash + "\n" + fingerprint);
+  }
+  dependencies.insert(dependencies.end(), included.begin(), included.end());
+  return true;
+}
+
+void Scanner::hashIncludes(const std::string& file, const std::string& source, std::set<std::string>& visited, std::vector<std::string>& dependencies, std::string& fingerprint)
+{
+  /* include paths are relative to the including file, like the YARA compiler resolves them */
+  RuleParser parser(source);
+  QDir dir = QFileInfo(file.c_str()).absoluteDir();
+  BOOST_FOREACH(const RuleParser::Statement& include, parser.includes()) {
+    const std::string path = QDir::cleanPath(dir.absoluteFilePath(include.value.c_str())).toStdString();
+    if (!visited.insert(path).second) {
+      continue; /* included twice, or an include cycle */
+    }
+    dependencies.push_back(path);
+
+    std::string included;
+    if (!readFile(path, included)) {
+      fingerprint += path + " missing\n"; /* the compile will report it */
+      continue;
+    }
+    fingerprint += path + " " + md5(included) + "\n";
+    hashIncludes(path, included, visited, dependencies, fingerprint);
+  }
+}
+
+std::string Scanner::md5(const std::string& data)
+{
+  QByteArray hashBytes = QCryptographicHash::hash(QByteArray(data.c_str(), data.size()), QCryptographicHash::Md5).toHex();
+  return std::string(hashBytes.constData(), hashBytes.length());
+}
+
+bool Scanner::readFile(const std::string& file, std::string& contents)
+{
+  std::ifstream input(file.c_str(), std::ifstream::binary);
+  if (!input.is_open()) {
+    return false;
+  }
+  std::stringstream ss;
+  ss << input.rdbuf();
+  if (input.bad()) {
+    return false;
+  }
+  contents = ss.str();
+  return true;
+}
+
+std::vector<std::string> Scanner::ruleCatalog(YR_RULES* rules)
+{
+  std::vector<std::string> catalog;
+  YR_RULE* rule = 0;
+  yr_rules_foreach(rules, rule) {
+    catalog.push_back(rule->identifier);
+  }
+  return catalog;
+}
+
+size_t Scanner::yaraStreamRead(void* ptr, size_t size, size_t count, void* userData)
+{
+  MemoryStream* memory = (MemoryStream*)userData;
+  if (!size) {
+    return 0;
+  }
+  size_t available = (memory->size - memory->pos) / size;
+  count = std::min(count, available);
+  memcpy(ptr, memory->data + memory->pos, count * size);
+  memory->pos += count * size;
+  return count;
+}
+
+size_t Scanner::yaraStreamWrite(const void* ptr, size_t size, size_t count, void* userData)
+{
+  std::vector<char>* buffer = (std::vector<char>*)userData;
+  const char* bytes = (const char*)ptr;
+  buffer->insert(buffer->end(), bytes, bytes + size * count);
+  return count;
+}
+
 std::string Scanner::yaraErrorToString(const int code)
 {
   switch (code) {
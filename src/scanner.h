@@ -6,9 +6,14 @@
 /* the calling thread requests a work operation on the YARA thread using boost::asio */
 
 #include "scanner_rule.h"
+#include "rule_bundle.h"
+#include "rule_selector.h"
 #include <boost/thread.hpp>
 #include <boost/asio.hpp>
 #include <boost/atomic.hpp>
+#include <vector>
+#include <map>
+#include <set>
 #include <yara/types.h>
 #include <yara/compiler.h>
 
@@ -19,6 +24,15 @@ public:
   ~Scanner();
   Scanner(boost::asio::io_service& caller);
 
+  struct HashResult
+  {
+    typedef boost::shared_ptr<HashResult> Ref;
+    std::string hash; /* empty if the file could not be read */
+    std::vector<std::string> dependencies; /* included files, in include order */
+    std::vector<std::vector<std::string> > partFiles; /* rule directories only, the files compiled together */
+    std::vector<std::string> partHashes;
+  };
+
   struct CompileResult
   {
     typedef boost::shared_ptr<CompileResult> Ref;
@@ -28,6 +42,23 @@ public:
     std::string compilerMessages;
     YR_RULES* rules; /* do not access this from anywhere but the Scanner thread */
     int ruleCount;
+    std::vector<std::string> catalog; /* rule identifiers */
+  };
+
+  struct SplitResult
+  {
+    typedef boost::shared_ptr<SplitResult> Ref;
+    std::string file;
+    std::string error;
+    std::vector<std::string> shards; /* a single entry means the file could not be split */
+  };
+
+  struct SelectResult
+  {
+    typedef boost::shared_ptr<SelectResult> Ref;
+    std::string source; /* the selected rules, empty if none were selected */
+    bool everything; /* nothing to leave out, or the file can not be reduced safely */
+    std::string error;
   };
 
   struct LoadResult
@@ -35,38 +66,79 @@ public:
     typedef boost::shared_ptr<LoadResult> Ref;
     YR_RULES* rules;
     std::string error;
+    std::vector<std::string> catalog;
   };
 
-  typedef boost::function<void (const std::string& hash)> RulesHashCallback;
+  struct BundleResult
+  {
+    typedef boost::shared_ptr<BundleResult> Ref;
+    std::vector<RuleBundle::Entry> entries;
+    std::map<std::string, YR_RULES*> rules; /* by cache key */
+    std::map<std::string, std::vector<std::string> > catalogs; /* rule identifiers of each binary, by cache key */
+    std::string error;
+  };
+
+  typedef boost::function<void (HashResult::Ref result)> RulesHashCallback;
   typedef boost::function<void (CompileResult::Ref result)> RulesCompileCallback;
+  typedef boost::function<void (SplitResult::Ref result)> RulesSplitCallback;
+  typedef boost::function<void (SelectResult::Ref result)> RulesSelectCallback;
   typedef boost::function<void (const std::string& error)> RulesSaveCallback;
   typedef boost::function<void (LoadResult::Ref result)> RulesLoadCallback;
+  typedef boost::function<void (BundleResult::Ref result)> BundleLoadCallback;
   typedef boost::function<void ()> RulesDestroyCallback;
   typedef boost::function<void (const ScannerRule::Ref rule)> ScanResultCallback;
   typedef boost::function<void (const std::string& error)> ScanCompleteCallback;
 
-  void rulesHash(const std::string& file, RulesHashCallback callback);
+  void rulesHash(const std::string& file, bool followIncludes, RulesHashCallback callback);
+  void rulesHashDirectory(const std::string& directory, size_t partCount, RulesHashCallback callback);
   void rulesCompile(const std::string& file, const std::string& ns, RulesCompileCallback callback);
+  void rulesCompileFiles(const std::vector<std::string>& files, const std::string& label, RulesCompileCallback callback);
+  void rulesCompileSource(const std::string& source, const std::string& file, const std::string& ns, RulesCompileCallback callback);
+  void rulesSplit(const std::string& file, size_t shardCount, RulesSplitCallback callback);
+  void rulesSelect(const std::string& file, const RuleSelector& selector, const std::string& ns, RulesSelectCallback callback);
   void rulesSave(YR_RULES* rules, const std::string& file, RulesSaveCallback callback);
   void rulesLoad(const std::string& file, RulesLoadCallback callback);
   void rulesDestroy(YR_RULES* rules, RulesDestroyCallback callback);
+  void bundleLoad(const std::string& file, BundleLoadCallback callback);
+  void bundleSave(const std::string& file, const std::vector<RuleBundle::Entry>& entries, const std::map<std::string, YR_RULES*>& rules, RulesSaveCallback callback);
   void scanStart(YR_RULES* rules, const std::string& file, int timeout, ScanResultCallback resultCallback, ScanCompleteCallback completeCallback);
   void scanStop();
 
 private:
 
-  void threadRulesHash(const std::string& file, RulesHashCallback callback);
+  void threadRulesHash(const std::string& file, bool followIncludes, RulesHashCallback callback);
+  void threadRulesHashDirectory(const std::string& directory, size_t partCount, RulesHashCallback callback);
   void threadRulesCompile(const std::string& file, const std::string& ns, RulesCompileCallback callback);
+  void threadRulesCompileFiles(const std::vector<std::string>& files, const std::string& label, RulesCompileCallback callback);
+  void threadRulesCompileSource(const std::string& source, const std::string& file, const std::string& ns, RulesCompileCallback callback);
+  void threadRulesSplit(const std::string& file, size_t shardCount, RulesSplitCallback callback);
+  void threadRulesSelect(const std::string& file, const RuleSelector& selector, const std::string& ns, RulesSelectCallback callback);
   void threadRulesSave(YR_RULES* rules, const std::string& file, RulesSaveCallback callback);
   void threadRulesLoad(const std::string& file, RulesLoadCallback callback);
   void threadRulesDestroy(YR_RULES* rules, RulesDestroyCallback callback);
+  void threadBundleLoad(const std::string& file, BundleLoadCallback callback);
+  void threadBundleSave(const std::string& file, const std::vector<RuleBundle::Entry>& entries, const std::map<std::string, YR_RULES*>& rules, RulesSaveCallback callback);
   void threadScanStart(YR_RULES* rules, const std::string& file, int timeout, ScanResultCallback resultCallback, ScanCompleteCallback completeCallback);
   void threadScanStop();
   void thread();
 
+  struct MemoryStream
+  {
+    uint8_t* data;
+    uint64_t size;
+    uint64_t pos;
+  };
+
+  static bool hashRules(const std::string& file, bool followIncludes, std::string& hash, std::vector<std::string>& dependencies);
+  static void hashIncludes(const std::string& file, const std::string& source, std::set<std::string>& visited, std::vector<std::string>& dependencies, std::string& fingerprint);
+  static std::string md5(const std::string& data);
   static int yaraScanCallback(int message, void* messageData, void* userData);
   static void yaraCompilerCallback(int errorLevel, const char* fileName, int lineNumber, const char* message, void* userData);
   static std::string yaraErrorToString(const int code);
+  static bool readFile(const std::string& file, std::string& contents);
+  static std::vector<std::string> ruleCatalog(YR_RULES* rules);
+  static size_t yaraStreamRead(void* ptr, size_t size, size_t count, void* userData);
+  static size_t yaraStreamWrite(const void* ptr, size_t size, size_t count, void* userData);
 
   boost::asio::io_service& m_caller; /* to post results back to the main thread */
 
@@ -2,8 +2,11 @@
 #include <boost/property_tree/json_parser.hpp>
 #include <boost/foreach.hpp>
 #include <boost/make_shared.hpp>
+#include <boost/thread.hpp>
+#include <algorithm>
 #include <QtCore/QCoreApplication>
 #include <QtCore/QDir>
+#include <QtCore/QStandardPaths>
 
 Settings::~Settings()
 {
@@ -72,3 +75,77 @@ void Settings::setRuleWindowGeoemtry(const std::string& state)
 {
   m_tree.put("geometry.rule_window", state);
 }
+
+std::string Settings::getCacheDirectory() const
+{
+  /* defaults to the platform cache location, which is $XDG_CACHE_HOME on linux */
+  QDir dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+  std::string defaultDir = dir.absoluteFilePath("rules").toStdString();
+  return m_tree.get<std::string>("cache.directory", defaultDir);
+}
+
+uint64_t Settings::getCacheBudget() const
+{
+  return m_tree.get<uint64_t>("cache.budget", 512ULL * 1024 * 1024);
+}
+
+int Settings::getShardCount() const
+{
+  /* rule files bigger than the threshold are split this many ways. 1 disables sharding */
+  return std::max(1, m_tree.get<int>("compiler.shards", 1));
+}
+
+int Settings::getCompileThreads() const
+{
+  /* rule directories are compiled in this many parts at once */
+  return std::max(1, m_tree.get<int>("compiler.threads", int(boost::thread::hardware_concurrency())));
+}
+
+uint64_t Settings::getShardThreshold() const
+{
+  return m_tree.get<uint64_t>("compiler.shard_threshold", 4ULL * 1024 * 1024);
+}
+
+uint64_t Settings::getStatsSampleBudget() const
+{
+  /* bytes read to estimate stats of targets over 16 times this size, at least one 64k block per slice. 0 disables */
+  return m_tree.get<uint64_t>("stats.sample_budget", 64ULL * 1024 * 1024);
+}
+
+std::string Settings::getStatsCacheDirectory() const
+{
+  QDir dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+  std::string defaultDir = dir.absoluteFilePath("stats").toStdString();
+  return m_tree.get<std::string>("stats.cache_directory", defaultDir);
+}
+
+uint64_t Settings::getStatsCacheBudget() const
+{
+  /* 0 disables the stats cache */
+  return m_tree.get<uint64_t>("stats.cache_budget", 256ULL * 1024 * 1024);
+}
+
+int Settings::getStatsThreads() const
+{
+  /* targets computed at once, each large file also reads in its own chunk threads. */
+  /* every exact pass may hold up to 128MB of trigram counts */
+  return std::max(1, m_tree.get<int>("stats.threads", 2));
+}
+
+bool Settings::getStatsOnDemand() const
+{
+  /* compute stats when a target is selected instead of for every scanned target */
+  return m_tree.get<bool>("stats.on_demand", false);
+}
+
+int Settings::getStatsPrefetch() const
+{
+  /* targets below the selected one computed ahead in on demand mode */
+  return std::max(0, m_tree.get<int>("stats.prefetch", 4));
+}
+
+std::string Settings::getStatsDigests() const
+{
+  /* hashes computed while exact stats are read, any of md5, sha1 and sha256. empty for none */
+  return m_tree.get<std::string>("stats.digests", "md5,sha1,sha256");
+}
@@ -5,6 +5,7 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/property_tree/ptree.hpp>
 #include <vector>
+#include <stdint.h>
 
 class Settings
 {
@@ -24,6 +25,21 @@ public:
   std::string getRuleWindowGeometry() const;
   void setRuleWindowGeoemtry(const std::string& state);
 
+  std::string getCacheDirectory() const;
+  uint64_t getCacheBudget() const;
+
+  int getShardCount() const;
+  int getCompileThreads() const;
+  uint64_t getShardThreshold() const;
+
+  uint64_t getStatsSampleBudget() const;
+  std::string getStatsCacheDirectory() const;
+  uint64_t getStatsCacheBudget() const;
+  int getStatsThreads() const;
+  bool getStatsOnDemand() const;
+  int getStatsPrefetch() const;
+  std::string getStatsDigests() const;
+
 private:
 
   boost::property_tree::ptree m_tree;
@@ -0,0 +1,183 @@
+#include "stats_cache.h"
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+#include <QtCore/QDirIterator>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSaveFile>
+#ifndef WIN32
+  #include <sys/stat.h>
+#endif
+
+namespace {
+
+const char* Magic = "yaragui stats 3";
+const uint64_t TrimTarget = 90; /* percent of the budget left after a trim, so it isn't repeated on every store */
+
+struct CachedFile
+{
+  std::string path;
+  uint64_t size;
+  int64_t modified;
+};
+
+bool writtenBefore(const CachedFile& a, const CachedFile& b)
+{
+  return a.modified < b.modified;
+}
+
+}
+
+bool StatsCache::Identity::operator==(const Identity& other) const
+{
+  return path == other.path && size == other.size && modified == other.modified && inode == other.inode && device == other.device;
+}
+
+StatsCache::~StatsCache()
+{
+}
+
+StatsCache::StatsCache(const std::string& directory, uint64_t budget) : m_directory(directory), m_budget(budget), m_total(0), m_counted(false)
+{
+}
+
+bool StatsCache::identify(const std::string& file, Identity& identity)
+{
+  QFileInfo info(file.c_str());
+  if (!info.isFile()) {
+    return false; /* devices and pipes have no stable identity */
+  }
+  identity.path = file;
+  identity.size = info.size();
+  identity.modified = info.lastModified().toMSecsSinceEpoch();
+  identity.inode = 0;
+  identity.device = 0;
+#ifndef WIN32
+  struct stat st;
+  if (stat(file.c_str(), &st) != 0) {
+    return false;
+  }
+  identity.inode = st.st_ino;
+  identity.device = st.st_dev;
+#endif
+  return true;
+}
+
+FileStats::Ref StatsCache::lookup(const Identity& identity, uint64_t sampleBudget) const
+{
+  if (!m_budget) {
+    return FileStats::Ref();
+  }
+
+  QFile file(entryPath(identity).c_str());
+  if (!file.open(QIODevice::ReadOnly)) {
+    return FileStats::Ref();
+  }
+  const QByteArray contents = file.readAll();
+  const std::string data(contents.constData(), contents.size());
+
+  /* the identity, then the sample budget the entry was computed with, 0 when exact */
+  const std::string expected = header(identity);
+  if (data.compare(0, expected.size(), expected) != 0) {
+    return FileStats::Ref();
+  }
+  const size_t budgetEnd = data.find('\n', expected.size());
+  if (budgetEnd == std::string::npos) {
+    return FileStats::Ref();
+  }
+  uint64_t budget = 0;
+  std::stringstream(data.substr(expected.size(), budgetEnd - expected.size())) >> budget;
+  if (budget && budget != sampleBudget) {
+    return FileStats::Ref();
+  }
+
+  return FileStats::deserialize(identity.path, data.substr(budgetEnd + 1));
+}
+
+void StatsCache::store(const Identity& identity, uint64_t sampleBudget, FileStats::Ref stats)
+{
+  if (!m_budget || !stats || stats->accessError()) {
+    return;
+  }
+
+  const std::string file = entryPath(identity);
+  QDir dir = QFileInfo(file.c_str()).absoluteDir();
+  if (!dir.exists() && !dir.mkpath(".")) {
+    return;
+  }
+
+  std::stringstream ss;
+  ss << header(identity) << (stats->isApproximate() ? sampleBudget : 0) << "\n";
+  const std::string data = ss.str() + stats->serialize();
+
+  /* written to a temp file and renamed so readers never see a partial entry */
+  const QFileInfo previous(file.c_str());
+  const uint64_t replaced = previous.exists() ? previous.size() : 0;
+  QSaveFile out(file.c_str());
+  if (!out.open(QIODevice::WriteOnly)) {
+    return;
+  }
+  out.write(data.c_str(), data.size());
+  if (!out.commit()) {
+    return;
+  }
+
+  boost::mutex::scoped_lock lock(m_mutex);
+  m_total = m_total + data.size() - std::min(m_total, replaced);
+  if (m_counted && m_total > m_budget) {
+    trimLocked();
+  }
+}
+
+void StatsCache::trim()
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  trimLocked();
+}
+
+void StatsCache::trimLocked()
+{
+  /* an entry stored while the directory is listed may be counted twice, which only trims early */
+  std::vector<CachedFile> files;
+  uint64_t total = 0;
+  QDirIterator it(m_directory.c_str(), QDir::Files, QDirIterator::Subdirectories);
+  while (it.hasNext()) {
+    QFileInfo info(it.next());
+    CachedFile cached;
+    cached.path = info.absoluteFilePath().toStdString();
+    cached.size = info.size();
+    cached.modified = info.lastModified().toMSecsSinceEpoch();
+    files.push_back(cached);
+    total += cached.size;
+  }
+
+  std::sort(files.begin(), files.end(), writtenBefore);
+  const uint64_t target = total > m_budget ? m_budget / 100 * TrimTarget : total;
+  for (size_t i = 0; i < files.size() && total > target; ++i) {
+    if (QFile::remove(files[i].path.c_str())) {
+      total -= files[i].size;
+    }
+  }
+  m_total = total;
+  m_counted = true;
+}
+
+std::string StatsCache::entryPath(const Identity& identity) const
+{
+  /* two levels so no single directory collects every entry */
+  const std::string key = header(identity);
+  const std::string hash = QCryptographicHash::hash(QByteArray(key.c_str(), int(key.size())), QCryptographicHash::Md5).toHex().toStdString();
+  QDir dir(m_directory.c_str());
+  return dir.absoluteFilePath((hash.substr(0, 2) + "/" + hash.substr(2)).c_str()).toStdString();
+}
+
+std::string StatsCache::header(const Identity& identity)
+{
+  std::stringstream ss;
+  ss << Magic << "\n" << identity.path << "\n" << identity.size << " " << identity.modified << " " << identity.inode << " " << identity.device << "\n";
+  return ss.str();
+}
@@ -0,0 +1,60 @@
+#ifndef __STATS_CACHE_H__
+#define __STATS_CACHE_H__
+
+/* finished FileStats kept on disk, one entry per file identity */
+/* an entry is named by a hash of the path, size, modification time, inode and device, and repeats them */
+/* in its header so a hash collision or a reused inode is never served. there is no shared index like the */
+/* rule cache has, since stats are looked up once per target and an index would be rewritten as often */
+
+#include "file_stats.h"
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <string>
+#include <stdint.h>
+
+class StatsCache
+{
+public:
+
+  typedef boost::shared_ptr<StatsCache> Ref;
+
+  struct Identity
+  {
+    std::string path; /* as requested, stats carry this name */
+    uint64_t size;
+    int64_t modified; /* ms since epoch */
+    uint64_t inode;
+    uint64_t device;
+
+    bool operator==(const Identity& other) const;
+  };
+
+  ~StatsCache();
+  StatsCache(const std::string& directory, uint64_t budget);
+
+  static bool identify(const std::string& file, Identity& identity); /* false if the file can't be examined */
+
+  /* approximate entries are only served to requests with the same sample budget */
+  FileStats::Ref lookup(const Identity& identity, uint64_t sampleBudget) const;
+  void store(const Identity& identity, uint64_t sampleBudget, FileStats::Ref stats);
+
+  /* evict the entries written longest ago until the cache fits its budget. store() trims again */
+  /* whenever the entries written since take it over budget */
+  void trim();
+
+private:
+
+  std::string entryPath(const Identity& identity) const;
+  static std::string header(const Identity& identity);
+  void trimLocked();
+
+  std::string m_directory;
+  uint64_t m_budget;
+
+  boost::mutex m_mutex; /* stores come from every stats thread */
+  uint64_t m_total; /* bytes on disk as of the last trim plus what was stored since */
+  bool m_counted; /* m_total is known, set by the first trim */
+
+};
+
+#endif // __STATS_CACHE_H__
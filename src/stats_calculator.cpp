@@ -1,16 +1,31 @@
 #include "stats_calculator.h"
 #include <boost/make_shared.hpp>
+#include <boost/foreach.hpp>
 #include <iostream>
 
 StatsCalculator::~StatsCalculator()
 {
-  m_thread_io.stop();
-  m_thread->join();
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_stopping = true;
+    for (std::multimap<std::string, JobRef>::iterator i = m_running.begin(); i != m_running.end(); ++i) {
+      *i->second->stop = true;
+    }
+  }
+  m_wake.notify_all();
+  m_threads.join_all();
 }
 
-StatsCalculator::StatsCalculator(boost::asio::io_service& io) : m_io(io)
+StatsCalculator::StatsCalculator(boost::asio::io_service& io, boost::shared_ptr<Settings> settings) : m_io(io), m_abort(false), m_stopping(false), m_sequence(0)
 {
-  m_thread = boost::make_shared<boost::thread>(boost::bind(&StatsCalculator::statsThread, this));
+  m_cache = boost::make_shared<StatsCache>(settings->getStatsCacheDirectory(), settings->getStatsCacheBudget());
+  m_digests = FileStats::parseDigests(settings->getStatsDigests());
+
+  /* the first worker trims the cache before it takes any jobs */
+  const int threads = settings->getStatsThreads();
+  for (int i = 0; i < threads; ++i) {
+    m_threads.create_thread(boost::bind(&StatsCalculator::statsThread, this, i == 0));
+  }
 }
 
 void StatsCalculator::reset()
@@ -21,24 +36,128 @@ void StatsCalculator::reset()
 void StatsCalculator::abort()
 {
   m_abort = true;
+  boost::mutex::scoped_lock lock(m_mutex);
+  for (std::multimap<std::string, JobRef>::iterator i = m_running.begin(); i != m_running.end(); ++i) {
+    *i->second->stop = true;
+  }
+}
+
+void StatsCalculator::getStats(const std::string& file, uint64_t sampleBudget, Priority priority)
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  std::map<std::string, JobRef>::iterator queued = m_queued.find(file);
+  if (queued != m_queued.end()) {
+    /* an exact request wins over a sampled one */
+    JobRef job = queued->second;
+    if (!sampleBudget || (job->sampleBudget && sampleBudget < job->sampleBudget)) {
+      job->sampleBudget = sampleBudget;
+    }
+    if (priority > job->priority) {
+      changePriority(job, priority);
+    }
+    return;
+  }
+
+  JobRef job = boost::make_shared<Job>();
+  job->file = file;
+  job->sampleBudget = sampleBudget;
+  job->priority = priority;
+  job->sequence = m_sequence++;
+  job->stop = boost::make_shared<boost::atomic<bool> >(false);
+  job->cancelled = false;
+  m_queued[file] = job;
+  m_queue.insert(queueKey(job));
+  m_wake.notify_one();
+}
+
+void StatsCalculator::setPriority(const std::vector<std::string>& files, Priority priority)
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  std::set<std::string> raised(files.begin(), files.end());
+
+  BOOST_FOREACH(const std::string& file, m_raised[priority]) {
+    std::map<std::string, JobRef>::iterator queued = m_queued.find(file);
+    if (!raised.count(file) && queued != m_queued.end() && queued->second->priority == priority) {
+      changePriority(queued->second, PriorityBackground);
+    }
+  }
+
+  BOOST_FOREACH(const std::string& file, raised) {
+    std::map<std::string, JobRef>::iterator queued = m_queued.find(file);
+    if (queued != m_queued.end() && queued->second->priority < priority) {
+      changePriority(queued->second, priority);
+    }
+  }
+  m_raised[priority].swap(raised);
 }
 
-void StatsCalculator::getStats(const std::string& file)
+void StatsCalculator::cancel(const std::string& file)
 {
-  m_thread_io.post(boost::bind(&StatsCalculator::computeStats, this, file));
+  boost::mutex::scoped_lock lock(m_mutex);
+  std::map<std::string, JobRef>::iterator queued = m_queued.find(file);
+  if (queued != m_queued.end()) {
+    m_queue.erase(queueKey(queued->second));
+    m_queued.erase(queued);
+  }
+  std::pair<std::multimap<std::string, JobRef>::iterator, std::multimap<std::string, JobRef>::iterator> running = m_running.equal_range(file);
+  for (std::multimap<std::string, JobRef>::iterator i = running.first; i != running.second; ++i) {
+    i->second->cancelled = true;
+    *i->second->stop = true;
+  }
 }
 
-void StatsCalculator::statsThread()
+void StatsCalculator::statsThread(bool trimCache)
 {
-  boost::asio::io_service::work keep_alive(boost::ref(m_thread_io));
-  m_thread_io.run();
+  if (trimCache) {
+    m_cache->trim();
+  }
+
+  boost::mutex::scoped_lock lock(m_mutex);
+  while (true) {
+    while (!m_stopping && m_queue.empty()) {
+      m_wake.wait(lock);
+    }
+    if (m_stopping) {
+      return;
+    }
+
+    std::map<std::string, JobRef>::iterator queued = m_queued.find(m_queue.begin()->second);
+    JobRef job = queued->second;
+    m_queue.erase(m_queue.begin());
+    m_queued.erase(queued);
+    *job->stop = m_abort.load();
+    std::multimap<std::string, JobRef>::iterator running = m_running.insert(std::make_pair(job->file, job));
+
+    lock.unlock();
+    computeStats(job);
+    lock.lock();
+    m_running.erase(running);
+  }
 }
 
-void StatsCalculator::computeStats(const std::string& file)
+void StatsCalculator::computeStats(JobRef job)
 {
-  /* in the stats thread */
-  FileStats::Ref stats = boost::make_shared<FileStats>(file, m_abort);
-  m_io.post(boost::bind(&StatsCalculator::reportStats, this, stats));
+  /* in a stats thread */
+  StatsCache::Identity identity;
+  const bool cacheable = StatsCache::identify(job->file, identity);
+  FileStats::Ref stats = cacheable ? m_cache->lookup(identity, job->sampleBudget) : FileStats::Ref();
+  if (stats && !stats->isApproximate() && !stats->hasDigests(m_digests)) {
+    stats.reset(); /* cached before these digests were configured */
+  }
+  if (!stats) {
+    stats = boost::make_shared<FileStats>(job->file, boost::cref(*job->stop), job->sampleBudget, boost::bind(&StatsCalculator::postProgress, this, _1), m_digests);
+
+    /* a file that changed while it was read would be cached under the wrong identity */
+    StatsCache::Identity after;
+    if (cacheable && StatsCache::identify(job->file, after) && after == identity) {
+      m_cache->store(identity, job->sampleBudget, stats);
+    }
+  }
+
+  boost::mutex::scoped_lock lock(m_mutex);
+  if (!job->cancelled) {
+    m_io.post(boost::bind(&StatsCalculator::reportStats, this, stats));
+  }
 }
 
 void StatsCalculator::reportStats(FileStats::Ref stats)
@@ -46,3 +165,28 @@ void StatsCalculator::reportStats(FileStats::Ref stats)
   /* in the main thread */
   onFileStats(stats);
 }
+
+void StatsCalculator::postProgress(FileStats::Ref stats)
+{
+  /* in a stats thread */
+  m_io.post(boost::bind(&StatsCalculator::reportProgress, this, stats));
+}
+
+void StatsCalculator::reportProgress(FileStats::Ref stats)
+{
+  /* in the main thread */
+  onFileStatsProgress(stats);
+}
+
+void StatsCalculator::changePriority(JobRef job, Priority priority)
+{
+  /* the lock is held */
+  m_queue.erase(queueKey(job));
+  job->priority = priority;
+  m_queue.insert(queueKey(job));
+}
+
+StatsCalculator::QueueKey StatsCalculator::queueKey(JobRef job)
+{
+  return QueueKey((uint64_t(PrioritySelected - job->priority) << 56) | job->sequence, job->file);
+}
@@ -1,12 +1,19 @@
 #ifndef __STATS_CALCULATOR_H__
 #define __STATS_CALCULATOR_H__
 
+/* computes FileStats on a pool of worker threads. jobs wait in a queue ordered by priority, then by */
+/* request order, so the target the user is looking at is computed before the rest of a large scan */
+
 #include <boost/shared_ptr.hpp>
 #include <boost/signals2.hpp>
 #include <boost/asio.hpp>
 #include <boost/thread.hpp>
 #include <boost/atomic.hpp>
 #include "file_stats.h"
+#include "stats_cache.h"
+#include "settings.h"
+#include <map>
+#include <set>
 
 class StatsCalculator
 {
@@ -14,25 +21,69 @@ public:
 
   typedef boost::shared_ptr<StatsCalculator> Ref;
 
+  enum Priority
+  {
+    PriorityBackground,
+    PriorityVisible,
+    PrioritySelected
+  };
+
   ~StatsCalculator();
-  StatsCalculator(boost::asio::io_service& io);
+  StatsCalculator(boost::asio::io_service& io, boost::shared_ptr<Settings> settings);
 
   boost::signals2::signal<void (FileStats::Ref stats)> onFileStats;
+  boost::signals2::signal<void (FileStats::Ref stats)> onFileStatsProgress; /* partial snapshots of large files */
 
   void reset();
-  void abort();
-  void getStats(const std::string& file);
+  void abort(); /* every job fails until reset */
+
+  /* a request for a file that is already queued is merged into that job */
+  void getStats(const std::string& file, uint64_t sampleBudget = 0, Priority priority = PriorityBackground);
+
+  /* exactly these queued files have the given priority now, others that had it go back to the background */
+  void setPriority(const std::vector<std::string>& files, Priority priority);
+
+  /* drop a queued job or stop a running one. cancelled jobs report nothing */
+  void cancel(const std::string& file);
 
 private:
 
-  void statsThread();
-  void computeStats(const std::string& file);
+  struct Job
+  {
+    std::string file;
+    uint64_t sampleBudget;
+    Priority priority;
+    uint64_t sequence;
+    boost::shared_ptr<boost::atomic<bool> > stop;
+    bool cancelled;
+  };
+
+  typedef boost::shared_ptr<Job> JobRef;
+  typedef std::pair<uint64_t, std::string> QueueKey; /* priority and sequence packed, smallest first */
+
+  void statsThread(bool trimCache);
+  void computeStats(JobRef job);
   void reportStats(FileStats::Ref stats);
+  void postProgress(FileStats::Ref stats);
+  void reportProgress(FileStats::Ref stats);
+
+  void changePriority(JobRef job, Priority priority);
+  static QueueKey queueKey(JobRef job);
 
   boost::asio::io_service& m_io;
-  boost::shared_ptr<boost::thread> m_thread;
-  boost::asio::io_service m_thread_io;
+  StatsCache::Ref m_cache;
+  boost::thread_group m_threads;
   boost::atomic<bool> m_abort;
+  unsigned m_digests; /* FileStats::DigestType mask */
+
+  boost::mutex m_mutex; /* guards everything below */
+  boost::condition_variable m_wake;
+  bool m_stopping;
+  uint64_t m_sequence;
+  std::map<std::string, JobRef> m_queued;
+  std::set<QueueKey> m_queue;
+  std::multimap<std::string, JobRef> m_running;
+  std::set<std::string> m_raised[PrioritySelected + 1];
 
 };
 
@@ -0,0 +1,154 @@
+#include "summary_window.h"
+#include <QtGui/QKeyEvent>
+#include <QtWidgets/QScrollBar>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+
+namespace {
+
+const int RefreshInterval = 500; /* ms */
+const size_t EntropyRows = 16;
+const size_t ProfileRows = 10;
+const int BarWidth = 40;
+
+std::string bar(uint64_t count, uint64_t most)
+{
+  return std::string(most ? size_t(count * BarWidth / most) : 0, '#');
+}
+
+std::string byteName(uint8_t b)
+{
+  std::stringstream ss;
+  ss << std::hex << std::setw(2) << std::setfill('0') << int(b);
+  if (b >= 0x21 && b < 0x7f && b != '<' && b != '>' && b != '&') {
+    ss << " '" << char(b) << "'";
+  }
+  return ss.str();
+}
+
+}
+
+SummaryWindow::SummaryWindow(CorpusStats::Ref corpus, bool onDemand, const QRect& parentGeometry) : m_corpus(corpus), m_onDemand(onDemand)
+{
+  m_ui.setupUi(this);
+  setWindowIcon(QIcon(":/yaragui.png"));
+
+  QRect selfGeometry = geometry();
+  selfGeometry.moveCenter(parentGeometry.center());
+  setGeometry(selfGeometry);
+
+  m_refreshTimer = new QTimer(this);
+  m_refreshTimer->setSingleShot(true);
+  connect(m_refreshTimer, SIGNAL(timeout()), this, SLOT(handleRefreshTimer()));
+
+  handleRefreshTimer();
+  show();
+}
+
+void SummaryWindow::refresh()
+{
+  if (!m_refreshTimer->isActive()) {
+    m_refreshTimer->start(RefreshInterval);
+  }
+}
+
+void SummaryWindow::keyPressEvent(QKeyEvent *event)
+{
+  switch(event->key())
+  {
+  case Qt::Key_Escape:
+    close();
+    break;
+  default:
+    QMainWindow::keyPressEvent(event);
+  }
+}
+
+void SummaryWindow::handleRefreshTimer()
+{
+  const CorpusStats& corpus = *m_corpus;
+  std::stringstream info;
+  info << std::fixed << std::setprecision(2);
+
+  info << "<p><b>" << corpus.fileCount() << " targets</b>, " << corpus.totalBytes() << " bytes";
+  if (corpus.errorCount()) {
+    info << ", " << corpus.errorCount() << " unreadable";
+  }
+  if (corpus.approximateCount()) {
+    info << ", " << corpus.approximateCount() << " sampled";
+  }
+  info << "</p>";
+  if (m_onDemand) {
+    info << "<p>Stats are computed on demand, only the targets selected or computed ahead of a selection are included.</p>";
+  }
+  if (corpus.fileCount() == corpus.errorCount()) {
+    m_ui.info->setHtml(info.str().c_str());
+    return;
+  }
+
+  /* quantiles */
+  const double quantiles[] = {0.01, 0.1, 0.5, 0.9, 0.99};
+  info << "<table cellspacing=\"4\"><tr><th align=\"left\">quantile</th><th align=\"right\">entropy</th><th align=\"right\">size</th></tr>";
+  for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); ++i) {
+    info << "<tr><td>" << int(quantiles[i] * 100) << "%</td>";
+    info << "<td align=\"right\">" << corpus.entropyQuantile(quantiles[i]) << "</td>";
+    info << "<td align=\"right\">" << corpus.sizeQuantile(quantiles[i]) << "</td></tr>";
+  }
+  info << "</table>";
+
+  /* entropy distribution */
+  const std::vector<uint64_t> entropy = corpus.entropyHistogram(EntropyRows);
+  const uint64_t mostEntropy = *std::max_element(entropy.begin(), entropy.end());
+  info << "<p><b>Entropy</b></p><pre>";
+  for (size_t i = 0; i < entropy.size(); ++i) {
+    info << std::setw(4) << 8.0 * i / entropy.size() << " " << std::setw(10) << entropy[i] << " " << bar(entropy[i], mostEntropy) << "\n";
+  }
+  info << "</pre>";
+
+  /* size distribution, from the smallest to the largest power of two seen */
+  const std::vector<uint64_t> sizes = corpus.sizeHistogram();
+  const uint64_t mostSizes = *std::max_element(sizes.begin(), sizes.end());
+  size_t first = 0, last = sizes.size();
+  while (first < last && !sizes[first]) {
+    first++;
+  }
+  while (last > first && !sizes[last - 1]) {
+    last--;
+  }
+  info << "<p><b>Size</b></p><pre>";
+  for (size_t i = first; i < last; ++i) {
+    info << "&lt; 2^" << std::setw(2) << std::left << i << std::right << " " << std::setw(10) << sizes[i] << " " << bar(sizes[i], mostSizes) << "\n";
+  }
+  info << "</pre>";
+
+  /* byte profiles */
+  const std::vector<CorpusStats::Profile> profiles = corpus.topProfiles(ProfileRows);
+  info << "<p><b>Most frequent bytes</b></p><table cellspacing=\"4\"><tr><th align=\"left\">top three bytes</th><th align=\"right\">targets</th></tr>";
+  for (size_t i = 0; i < profiles.size(); ++i) {
+    info << "<tr><td><tt>" << byteName(profiles[i].bytes[0]) << ", " << byteName(profiles[i].bytes[1]) << ", " << byteName(profiles[i].bytes[2]) << "</tt></td>";
+    info << "<td align=\"right\">" << profiles[i].count;
+    if (profiles[i].error) {
+      info << " (at least " << profiles[i].count - profiles[i].error << ")";
+    }
+    info << "</td></tr>";
+  }
+  info << "</table>";
+
+  const std::vector<double> frequency = corpus.byteFrequency();
+  std::vector<std::pair<double, int> > common;
+  for (int b = 0; b < 256; ++b) {
+    common.push_back(std::make_pair(frequency[b], b));
+  }
+  std::sort(common.rbegin(), common.rend());
+  info << "<p>Over all bytes: ";
+  for (size_t i = 0; i < 8; ++i) {
+    info << (i ? ", " : "") << "<tt>" << byteName(uint8_t(common[i].second)) << "</tt> " << common[i].first * 100 << "%";
+  }
+  info << "</p>";
+
+  /* keep the reader's place while the scan adds to it */
+  const int scroll = m_ui.info->verticalScrollBar()->value();
+  m_ui.info->setHtml(info.str().c_str());
+  m_ui.info->verticalScrollBar()->setValue(scroll);
+}
@@ -0,0 +1,37 @@
+#ifndef __SUMMARY_WINDOW_H__
+#define __SUMMARY_WINDOW_H__
+
+/* aggregate stats of the targets in the last scan */
+
+#include "ui_summary_window.h"
+#include "corpus_stats.h"
+#include <QtCore/QTimer>
+
+class SummaryWindow : public QMainWindow
+{
+  Q_OBJECT
+
+public:
+
+  SummaryWindow(CorpusStats::Ref corpus, bool onDemand, const QRect& parentGeometry); /* onDemand if only viewed targets have stats */
+
+  void refresh(); /* the corpus changed, redrawn at most a few times a second */
+
+private:
+
+  void keyPressEvent(QKeyEvent *event);
+
+private slots:
+
+  void handleRefreshTimer();
+
+private:
+
+  Ui::SummaryWindow m_ui;
+  CorpusStats::Ref m_corpus;
+  bool m_onDemand;
+  QTimer* m_refreshTimer;
+
+};
+
+#endif // __SUMMARY_WINDOW_H__
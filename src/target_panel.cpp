@@ -2,9 +2,10 @@
 #include <sstream>
 #include <QtWidgets/QToolBar>
 #include <QtGui/QPainter>
+#include <QtGui/QWheelEvent>
 #include "gfx_math.h"
 
-TargetPanel::TargetPanel(QWidget* parent)
+TargetPanel::TargetPanel(QWidget* parent) : m_zoomBegin(0), m_zoomEnd(0)
 {
   m_ui.setupUi(this);
   hide();
@@ -17,6 +18,9 @@ TargetPanel::TargetPanel(QWidget* parent)
 
   connect(m_ui.slider, SIGNAL(valueChanged(int)), this, SLOT(handleSlider()));
 
+  /* the wheel zooms the 1d graph of large files, a double click shows the whole file again */
+  m_ui.leftGraph->installEventFilter(this);
+
   m_lineGraphButton = tb->addAction("1D Entropy");
   connect(m_lineGraphButton, SIGNAL(triggered()), this, SLOT(showLineGraph()));
   m_lineGraphButton->setIcon(QIcon(":/glyphicons-460-header.png"));
@@ -29,11 +33,21 @@ TargetPanel::TargetPanel(QWidget* parent)
   connect(m_barGraphButton, SIGNAL(triggered()), this, SLOT(showBarGraph()));
   m_barGraphButton->setIcon(QIcon(":/glyphicons-42-charts.png"));
 
+  /* stats of very large targets are estimated from a sample, this reads the whole file */
+  tb->addSeparator();
+  m_exactButton = tb->addAction("Compute Exact Statistics");
+  connect(m_exactButton, SIGNAL(triggered()), this, SLOT(handleExactStats()));
+  m_exactButton->setIcon(QIcon(":/glyphicons-82-refresh.png"));
+  m_exactButton->setEnabled(false);
+
   showLineGraph();
 }
 
 void TargetPanel::show(const std::string& filename, FileStats::Ref stats)
 {
+  if (filename != m_filename) {
+    m_zoomBegin = m_zoomEnd = 0;
+  }
   m_filename = filename;
 
   if (!stats || stats->accessError()) {
@@ -43,6 +57,7 @@ void TargetPanel::show(const std::string& filename, FileStats::Ref stats)
     m_stats = stats;
   }
 
+  m_exactButton->setEnabled(m_stats && m_stats->isApproximate());
   updateInfo();
   prepareHistogram();
   QWidget::show();
@@ -82,6 +97,13 @@ void TargetPanel::handleSlider()
   renderView();
 }
 
+void TargetPanel::handleExactStats()
+{
+  /* stays disabled until the exact stats arrive */
+  m_exactButton->setEnabled(false);
+  onRequestExactStats(m_filename);
+}
+
 void TargetPanel::renderView()
 {
   if (!m_stats) {
@@ -90,6 +112,7 @@ void TargetPanel::renderView()
     m_ui.slider->hide();
     m_ui.progressBar->hide();
     m_ui.sizeText->hide();
+    m_ui.digestText->hide();
     return;
   }
 
@@ -115,6 +138,12 @@ void TargetPanel::renderView()
 
 void TargetPanel::renderHistogram()
 {
+  if (m_histogramPixmap.isNull()) {
+    m_ui.leftGraph->setPixmap(QPixmap());
+    m_ui.leftGraph->setText("2D entropy is shown when the whole file has been read");
+    return;
+  }
+
   /* already computed in prepareHistogram() */
   m_ui.leftGraph->setPixmap(m_histogramPixmap.scaled(m_ui.leftGraph->size(), Qt::IgnoreAspectRatio, Qt::SmoothTransformation));
 }
@@ -157,8 +186,13 @@ void TargetPanel::renderLineGraph()
     painter.drawLine(xpos, 0, xpos, height);
   }
 
-  /* get graph limits for scaling */
+  /* zoomed in, from the finer counts kept for large files */
   std::vector<double> data = m_stats->entropy1d();
+  if (m_zoomEnd && m_stats->canZoom()) {
+    data = m_stats->entropyRange(m_zoomBegin, m_zoomEnd, std::max(256, pixmap.width() / 2));
+  }
+
+  /* get graph limits for scaling */
   double dataMin = std::numeric_limits<double>::max();
   double dataMax = -std::numeric_limits<double>::max();
   for(size_t i = 0; i < data.size(); ++i) {
@@ -300,13 +334,36 @@ void TargetPanel::updateInfo()
 
   std::stringstream size;
   size << "" << m_stats->fileSize() << " bytes";
+  if (m_stats->isPartial()) {
+    size << " (reading, " << int(m_stats->progress() * 100) << "% done)";
+  } else if (m_stats->isApproximate()) {
+    size.precision(1);
+    size << " (approximate, " << std::fixed << 100.0 * m_stats->sampledBytes() / m_stats->fileSize() << "% sampled)";
+  }
+  if (m_zoomEnd && m_stats->canZoom()) {
+    size << ", showing " << m_zoomBegin << " to " << m_zoomEnd;
+  }
   m_ui.sizeText->setText(size.str().c_str());
 
+  /* one line to copy from, one digest per line in the tooltip */
+  std::string digests, tooltip;
+  for (FileStats::Digests::const_iterator i = m_stats->digests().begin(); i != m_stats->digests().end(); ++i) {
+    digests += (digests.empty() ? "" : "  ") + i->first + " " + i->second;
+    tooltip += (tooltip.empty() ? "" : "\n") + i->first + ": " + i->second;
+  }
+  m_ui.digestText->setText(digests.c_str());
+  m_ui.digestText->setToolTip(tooltip.c_str());
+  m_ui.digestText->setVisible(!digests.empty());
+
   std::stringstream entropy;
   entropy.precision(2);
   double totalEntropy = m_stats->totalEntropy();
   totalEntropy = totalEntropy == 0 ? 0 : totalEntropy;
-  entropy << "" << std::fixed << totalEntropy << " bits";
+  if (m_stats->isApproximate()) {
+    entropy << "~" << std::fixed << totalEntropy << " +/- " << m_stats->entropyError() << " bits";
+  } else {
+    entropy << "" << std::fixed << totalEntropy << " bits";
+  }
 
   double bar = totalEntropy / 8 * 100;
   m_ui.progressBar->setValue(bar);
@@ -328,6 +385,10 @@ void TargetPanel::prepareHistogram()
     return;
   }
   const std::vector<double>& entropy2d = m_stats->entropy2d();
+  if (entropy2d.empty()) {
+    m_histogramPixmap = QPixmap(); /* partial stats */
+    return;
+  }
   m_histogramBuffer = std::vector<int>(256 * 256);
   for (int y = 0; y < 256; ++y) {
     for (int x = 0; x < 256; ++x) {
@@ -350,3 +411,44 @@ void TargetPanel::resizeEvent(QResizeEvent* event)
   renderView();
   QWidget::resizeEvent(event);
 }
+
+bool TargetPanel::eventFilter(QObject* object, QEvent* event)
+{
+  if (object != m_ui.leftGraph || m_viewMode != ViewModeLineGraph || !m_stats || !m_stats->canZoom()) {
+    return QWidget::eventFilter(object, event);
+  }
+
+  if (event->type() == QEvent::Wheel) {
+    QWheelEvent* wheel = static_cast<QWheelEvent*>(event);
+    const double center = wheel->pos().x() / double(std::max(1, m_ui.leftGraph->width()));
+    zoom(wheel->angleDelta().y() > 0 ? 0.5 : 2.0, center);
+    return true;
+  }
+  if (event->type() == QEvent::MouseButtonDblClick) {
+    m_zoomBegin = m_zoomEnd = 0;
+    updateInfo();
+    renderView();
+    return true;
+  }
+  return QWidget::eventFilter(object, event);
+}
+
+void TargetPanel::zoom(double factor, double center)
+{
+  /* keep the byte under the cursor where it is */
+  const uint64_t fileSize = m_stats->fileSize();
+  const uint64_t begin = m_zoomEnd ? m_zoomBegin : 0;
+  const uint64_t end = m_zoomEnd ? m_zoomEnd : fileSize;
+  const double pivot = begin + (end - begin) * std::min(1.0, std::max(0.0, center));
+  const double span = std::max(4096.0, (end - begin) * factor);
+
+  if (span >= fileSize) {
+    m_zoomBegin = m_zoomEnd = 0;
+  } else {
+    const double first = std::min(std::max(0.0, pivot - span * center), fileSize - span);
+    m_zoomBegin = uint64_t(first);
+    m_zoomEnd = uint64_t(first + span);
+  }
+  updateInfo();
+  renderView();
+}
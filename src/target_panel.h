@@ -3,6 +3,7 @@
 
 #include "ui_target_panel.h"
 #include "file_stats.h"
+#include <boost/signals2.hpp>
 #include <vector>
 
 class TargetPanel : public QWidget
@@ -13,6 +14,8 @@ public:
 
   TargetPanel(QWidget* parent);
 
+  boost::signals2::signal<void (const std::string& filename)> onRequestExactStats;
+
   void show(const std::string& filename, FileStats::Ref stats);
 
   std::string filename() const {return m_filename;}
@@ -23,6 +26,7 @@ private slots:
   void showLineGraph();
   void showBarGraph();
   void handleSlider();
+  void handleExactStats();
 
 private:
 
@@ -45,6 +49,9 @@ private:
   double sliderValue() const;
 
   virtual void resizeEvent(QResizeEvent* event);
+  virtual bool eventFilter(QObject* object, QEvent* event);
+
+  void zoom(double factor, double center); /* center is a fraction of the graph width */
 
   Ui::TargetPanel m_ui;
   std::string m_filename;
@@ -54,6 +61,10 @@ private:
   QAction* m_histogramButton;
   QAction* m_lineGraphButton;
   QAction* m_barGraphButton;
+  QAction* m_exactButton;
+
+  uint64_t m_zoomBegin; /* bytes shown in the 1d graph, the whole file when both are 0 */
+  uint64_t m_zoomEnd;
 
   std::vector<int> m_histogramBuffer;
   QPixmap m_histogramPixmap;
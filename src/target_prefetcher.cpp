@@ -0,0 +1,91 @@
+#include "target_prefetcher.h"
+#include <boost/make_shared.hpp>
+#include <algorithm>
+#include <QtCore/QDir>
+#include <QtCore/QFileInfo>
+#ifndef WIN32
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+
+namespace {
+
+/* stay well below the page cache so prefetched data is not evicted before the scan reaches it */
+const size_t PrefetchFiles = 256;
+const uint64_t PrefetchBytes = 64 * 1024 * 1024;
+
+}
+
+TargetPrefetcher::~TargetPrefetcher()
+{
+  m_thread_io.stop();
+  m_thread->join();
+}
+
+TargetPrefetcher::TargetPrefetcher() : m_generation(0)
+{
+  m_thread = boost::make_shared<boost::thread>(boost::bind(&TargetPrefetcher::prefetchThread, this));
+}
+
+void TargetPrefetcher::prefetch(const std::list<std::string>& targets)
+{
+  m_thread_io.post(boost::bind(&TargetPrefetcher::walk, this, targets, ++m_generation));
+}
+
+void TargetPrefetcher::abort()
+{
+  ++m_generation;
+}
+
+void TargetPrefetcher::prefetchThread()
+{
+  boost::asio::io_service::work keep_alive(boost::ref(m_thread_io));
+  m_thread_io.run();
+}
+
+void TargetPrefetcher::walk(std::list<std::string> targets, unsigned int generation)
+{
+  /* in the prefetch thread */
+  size_t files = 0;
+  uint64_t bytes = 0;
+  while (!targets.empty() && files < PrefetchFiles && bytes < PrefetchBytes) {
+    if (m_generation != generation) {
+      return; /* aborted or superseded by a newer scan */
+    }
+
+    /* same depth first order as RulesetManager::scanWithCompiledRules */
+    const std::string target = targets.front();
+    targets.pop_front();
+    QFileInfo fileInfo(target.c_str());
+    if (fileInfo.isDir()) {
+      QDir dir(target.c_str());
+      QStringList entries = dir.entryList(QDir::AllEntries | QDir::NoDotAndDotDot);
+      for (int i = entries.size() - 1; i >= 0; --i) {
+        targets.push_front(QDir::toNativeSeparators(dir.absoluteFilePath(entries[i])).toStdString());
+      }
+      continue;
+    }
+
+    if (!fileInfo.isFile()) {
+      continue; /* devices and pipes are never read ahead */
+    }
+
+    const uint64_t size = std::min<uint64_t>(fileInfo.size(), PrefetchBytes - bytes);
+    readAhead(target, size);
+    bytes += size;
+    files++;
+  }
+}
+
+void TargetPrefetcher::readAhead(const std::string& file, uint64_t size)
+{
+#ifndef WIN32
+  /* asynchronous, the kernel queues the reads and returns immediately */
+  int fd = open(file.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  posix_fadvise(fd, 0, size, POSIX_FADV_WILLNEED);
+  close(fd);
+#endif
+}
@@ -0,0 +1,40 @@
+#ifndef __TARGET_PREFETCHER_H__
+#define __TARGET_PREFETCHER_H__
+
+/* warms the file system caches for the first scan targets while rules are still being prepared */
+/* it walks the targets in the same order as the scan, stats them and asks the kernel to read ahead */
+/* nothing is reported back, the scan simply finds the directories and data already cached */
+
+#include <boost/shared_ptr.hpp>
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <string>
+#include <list>
+#include <stdint.h>
+
+class TargetPrefetcher
+{
+public:
+
+  typedef boost::shared_ptr<TargetPrefetcher> Ref;
+
+  ~TargetPrefetcher();
+  TargetPrefetcher();
+
+  void prefetch(const std::list<std::string>& targets); /* replaces any prefetch in progress */
+  void abort();
+
+private:
+
+  void prefetchThread();
+  void walk(std::list<std::string> targets, unsigned int generation);
+  void readAhead(const std::string& file, uint64_t size);
+
+  boost::shared_ptr<boost::thread> m_thread;
+  boost::asio::io_service m_thread_io;
+  boost::atomic<unsigned int> m_generation; /* bumped to cancel the current walk */
+
+};
+
+#endif // __TARGET_PREFETCHER_H__
@@ -0,0 +1,238 @@
+#include "trigram_histogram.h"
+#include "entropy_table.h"
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <algorithm>
+
+namespace
+{
+  const uint32_t DenseSize = 1 << 24;
+  const uint32_t Empty = 0xffffffff; /* sparse slot with no trigram, not a valid 24 bit key */
+  const size_t SparseInitial = 1 << 12;
+  const size_t SparseLimit = 1 << 21; /* past this many distinct trigrams the flat array is smaller */
+  const size_t LaneWords = (1 << 16) / 64;
+  const size_t LanesPerThread = 4096; /* fewer occupied lanes than this aren't worth a thread */
+
+  inline size_t slot(uint32_t trigram, size_t mask)
+  {
+    return (trigram * 2654435761u) & mask;
+  }
+}
+
+TrigramHistogram::TrigramHistogram(uint64_t expected) : m_used(0)
+{
+  if (expected >= DenseSize / 2) {
+    m_dense = std::vector<uint32_t>(DenseSize);
+    m_occupied = std::vector<uint64_t>(LaneWords);
+    return;
+  }
+
+  /* a file can't hold more distinct trigrams than it has trigrams */
+  size_t capacity = SparseInitial;
+  while (capacity < expected * 2 && capacity < SparseLimit * 2) {
+    capacity *= 2;
+  }
+  m_keys = std::vector<uint32_t>(capacity, Empty);
+  m_counts = std::vector<uint32_t>(capacity);
+}
+
+void TrigramHistogram::addSparse(uint32_t trigram)
+{
+  const size_t mask = m_keys.size() - 1;
+  size_t i = slot(trigram, mask);
+  while (m_keys[i] != trigram) {
+    if (m_keys[i] == Empty) {
+      if ((m_used + 1) * 2 > m_keys.size()) {
+        grow();
+        add(trigram);
+        return;
+      }
+      m_keys[i] = trigram;
+      m_used++;
+      break;
+    }
+    i = (i + 1) & mask;
+  }
+  if (!++m_counts[i]) {
+    m_overflow[trigram]++;
+  }
+}
+
+void TrigramHistogram::grow()
+{
+  if (m_keys.size() >= SparseLimit * 2) {
+    makeDense();
+    return;
+  }
+
+  std::vector<uint32_t> keys(m_keys.size() * 2, Empty);
+  std::vector<uint32_t> counts(keys.size());
+  const size_t mask = keys.size() - 1;
+  for (size_t j = 0; j < m_keys.size(); ++j) {
+    if (m_keys[j] == Empty) {
+      continue;
+    }
+    size_t i = slot(m_keys[j], mask);
+    while (keys[i] != Empty) {
+      i = (i + 1) & mask;
+    }
+    keys[i] = m_keys[j];
+    counts[i] = m_counts[j];
+  }
+  m_keys.swap(keys);
+  m_counts.swap(counts);
+}
+
+void TrigramHistogram::makeDense()
+{
+  m_dense = std::vector<uint32_t>(DenseSize);
+  m_occupied = std::vector<uint64_t>(LaneWords);
+  for (size_t j = 0; j < m_keys.size(); ++j) {
+    if (m_keys[j] != Empty) {
+      m_dense[m_keys[j]] = m_counts[j];
+      m_occupied[m_keys[j] >> 14] |= uint64_t(1) << ((m_keys[j] >> 8) & 63);
+    }
+  }
+  std::vector<uint32_t>().swap(m_keys);
+  std::vector<uint32_t>().swap(m_counts);
+  m_used = 0;
+}
+
+void TrigramHistogram::add(uint32_t trigram, uint64_t count)
+{
+  /* find or insert the counter, then add with carry into the side map */
+  uint32_t* low = 0;
+  if (!m_dense.empty()) {
+    low = &m_dense[trigram];
+    m_occupied[trigram >> 14] |= uint64_t(1) << ((trigram >> 8) & 63);
+  } else {
+    if ((m_used + 1) * 2 > m_keys.size()) {
+      grow();
+      add(trigram, count);
+      return;
+    }
+    const size_t mask = m_keys.size() - 1;
+    size_t i = slot(trigram, mask);
+    while (m_keys[i] != trigram && m_keys[i] != Empty) {
+      i = (i + 1) & mask;
+    }
+    if (m_keys[i] == Empty) {
+      m_keys[i] = trigram;
+      m_used++;
+    }
+    low = &m_counts[i];
+  }
+  const uint64_t sum = *low + count;
+  *low = uint32_t(sum);
+  if (sum >> 32) {
+    m_overflow[trigram] += uint32_t(sum >> 32);
+  }
+}
+
+void TrigramHistogram::merge(const TrigramHistogram& other)
+{
+  if (!other.m_dense.empty()) {
+    for (uint32_t lane = 0; lane < (1 << 16); ++lane) {
+      if (!(other.m_occupied[lane >> 6] >> (lane & 63) & 1)) {
+        continue;
+      }
+      for (uint32_t trigram = lane << 8; trigram < (lane + 1) << 8; ++trigram) {
+        if (other.m_dense[trigram]) {
+          add(trigram, other.m_dense[trigram]);
+        }
+      }
+    }
+  } else {
+    for (size_t j = 0; j < other.m_keys.size(); ++j) {
+      if (other.m_keys[j] != Empty) {
+        add(other.m_keys[j], other.m_counts[j]);
+      }
+    }
+  }
+  for (std::map<uint32_t, uint32_t>::const_iterator high = other.m_overflow.begin(); high != other.m_overflow.end(); ++high) {
+    add(high->first, uint64_t(high->second) << 32);
+  }
+}
+
+uint64_t TrigramHistogram::count(uint32_t trigram, uint32_t low) const
+{
+  if (m_overflow.empty()) {
+    return low;
+  }
+  std::map<uint32_t, uint32_t>::const_iterator high = m_overflow.find(trigram);
+  return high == m_overflow.end() ? low : (uint64_t(high->second) << 32) + low;
+}
+
+std::vector<double> TrigramHistogram::laneEntropy() const
+{
+  /* H = log2(z) - sum(c log2 c) / z, with z the number of trigrams sharing the prefix */
+  std::vector<double> entropy(256 * 256);
+  if (!m_dense.empty()) {
+    /* equal shares of the occupied lanes, each thread writes its own lanes */
+    size_t occupied = 0;
+    for (size_t word = 0; word < LaneWords; ++word) {
+      for (uint64_t bits = m_occupied[word]; bits; bits &= bits - 1) {
+        occupied++;
+      }
+    }
+    const size_t maxThreads = std::max(1u, std::min(4u, boost::thread::hardware_concurrency()));
+    const size_t threadCount = std::max<size_t>(1, std::min(maxThreads, occupied / LanesPerThread));
+
+    boost::thread_group threads;
+    size_t firstWord = 0;
+    for (size_t t = 1; t < threadCount; ++t) {
+      size_t lastWord = firstWord;
+      size_t share = 0;
+      while (lastWord < LaneWords && share < occupied / threadCount) {
+        for (uint64_t bits = m_occupied[lastWord++]; bits; bits &= bits - 1) {
+          share++;
+        }
+      }
+      threads.create_thread(boost::bind(&TrigramHistogram::denseLaneEntropy, this, firstWord, lastWord, boost::ref(entropy)));
+      firstWord = lastWord;
+    }
+    denseLaneEntropy(firstWord, LaneWords, entropy);
+    threads.join_all();
+  } else {
+    std::vector<uint64_t> total(256 * 256);
+    std::vector<double> weighted(256 * 256);
+    for (size_t j = 0; j < m_keys.size(); ++j) {
+      if (m_keys[j] == Empty) {
+        continue;
+      }
+      const uint64_t c = count(m_keys[j], m_counts[j]);
+      total[m_keys[j] >> 8] += c;
+      weighted[m_keys[j] >> 8] += EntropyTable::nlogn(c);
+    }
+    for (size_t lane = 0; lane < entropy.size(); ++lane) {
+      entropy[lane] = EntropyTable::entropy(total[lane], weighted[lane]);
+    }
+  }
+  return entropy;
+}
+
+void TrigramHistogram::denseLaneEntropy(size_t firstWord, size_t lastWord, std::vector<double>& entropy) const
+{
+  for (size_t word = firstWord; word < lastWord; ++word) {
+    const uint64_t bits = m_occupied[word];
+    for (uint32_t bit = 0; bits && bit < 64; ++bit) {
+      if (!(bits >> bit & 1)) {
+        continue;
+      }
+      const uint32_t lane = uint32_t(word * 64 + bit);
+      const uint32_t* counts = &m_dense[lane << 8];
+      if (m_overflow.empty()) {
+        entropy[lane] = EntropyTable::entropy(counts, 256);
+        continue;
+      }
+      uint64_t total = 0;
+      double weighted = 0;
+      for (uint32_t z = 0; z < 256; ++z) {
+        const uint64_t c = count((lane << 8) | z, counts[z]);
+        total += c;
+        weighted += EntropyTable::nlogn(c);
+      }
+      entropy[lane] = EntropyTable::entropy(total, weighted);
+    }
+  }
+}
@@ -0,0 +1,58 @@
+#ifndef __TRIGRAM_HISTOGRAM_H__
+#define __TRIGRAM_HISTOGRAM_H__
+
+/* counts of every three byte sequence in a file, stored so memory follows the data */
+/* small inputs use an open addressing table of the trigrams actually seen, large ones */
+/* a flat array of 2^24 32-bit counters. a counter that wraps carries into a side map, so counts stay exact */
+
+#include <vector>
+#include <map>
+#include <stddef.h>
+#include <stdint.h>
+
+class TrigramHistogram
+{
+public:
+
+  TrigramHistogram(uint64_t expected); /* expected number of trigrams, picks the initial layout */
+
+  void add(uint32_t trigram) /* b0 << 16 | b1 << 8 | b2 */
+  {
+    if (!m_dense.empty()) {
+      uint32_t& counter = m_dense[trigram];
+      if (!counter) {
+        m_occupied[trigram >> 14] |= uint64_t(1) << ((trigram >> 8) & 63);
+      }
+      if (!++counter) {
+        m_overflow[trigram]++;
+      }
+    } else {
+      addSparse(trigram);
+    }
+  }
+
+  void add(uint32_t trigram, uint64_t count);
+  void merge(const TrigramHistogram& other);
+
+  /* entropy of the last byte for each two byte prefix, indexed by b0 << 8 | b1. 0 for unseen prefixes. */
+  /* only lanes that were seen are computed, split across threads when there are many */
+  std::vector<double> laneEntropy() const;
+
+private:
+
+  void addSparse(uint32_t trigram);
+  void grow();
+  void makeDense();
+  uint64_t count(uint32_t trigram, uint32_t low) const;
+  void denseLaneEntropy(size_t firstWord, size_t lastWord, std::vector<double>& entropy) const;
+
+  std::vector<uint32_t> m_dense;
+  std::vector<uint64_t> m_occupied; /* one bit per lane of m_dense that has any count */
+  std::vector<uint32_t> m_keys;
+  std::vector<uint32_t> m_counts;
+  size_t m_used;
+  std::map<uint32_t, uint32_t> m_overflow; /* multiples of 2^32 */
+
+};
+
+#endif // __TRIGRAM_HISTOGRAM_H__